@@ -16,6 +16,13 @@ static char const color_cyan[] = "\x1b[36m";
 static char const color_white[] = "\x1b[37m";
 static char const color_normal[] = "\x1b[39m";
 
+/* ANSI color numbers plus one, so that zero is the default color */
+enum color {
+    COLOR_NORMAL = 0,
+    COLOR_BLACK, COLOR_RED, COLOR_GREEN, COLOR_YELLOW,
+    COLOR_BLUE, COLOR_PURPLE, COLOR_CYAN, COLOR_WHITE,
+};
+
 static char const bold_on[] = "\x1b[1m", bold_off[] = "\x1b[22m"; /* not a typo */
 static char const underline_on[] = "\x1b[4m", underline_off[] = "\x1b[24m";
 static char const inverse_video_on[] = "\x1b[7m", inverse_video_off[] = "\x1b[27m";
@@ -33,4 +40,9 @@ static char const show_cursor[] = "\x1b[?25h", hide_cursor[] = "\x1b[?25l";
 static char const enter_alternate_screen[] = "\x1b[?1049h\x1b[0;0H";
 static char const leave_alternate_screen[] = "\x1b[?1049l";
 
+static char const sync_update_on[] = "\x1b[?2026h", sync_update_off[] = "\x1b[?2026l";
+
+/* report mouse buttons as "\x1b[<b;x;yM" */
+static char const mouse_on[] = "\x1b[?1000h\x1b[?1006h", mouse_off[] = "\x1b[?1006l\x1b[?1000l";
+
 #endif
@@ -0,0 +1,313 @@
+/*
+ * Microbenchmarks for the blob, history and search primitives.
+ *
+ * All inputs are generated locally.  Prints the results as JSON on stdout;
+ * throughput is in bytes of blob data processed per second where that is
+ * meaningful, otherwise zero.
+ *
+ * usage: bench/bench [filter]
+ */
+
+#define _GNU_SOURCE
+
+#include "common.h"
+#include "blob.h"
+#include "history.h"
+#include "search.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define MIN_TIME 200000 /* microseconds per benchmark */
+#define MiB (1 << 20)
+
+static char const *filter;
+static bool first = true;
+
+static uint64_t rng = 0x9e3779b97f4a7c15;
+
+static uint64_t rand64(void)
+{
+    rng ^= rng << 13, rng ^= rng >> 7, rng ^= rng << 17;
+    return rng;
+}
+
+/* zero runs, text and noise, in blocks of 4 KiB */
+static void fill(byte *buf, size_t len)
+{
+    static char const text[] = "the quick brown fox jumps over the lazy dog. ";
+    for (size_t i = 0; i < len; ++i) {
+        switch (i / 0x1000 % 4) {
+        case 0: buf[i] = 0; break;
+        case 1: buf[i] = text[i % (sizeof(text) - 1)]; break;
+        default: buf[i] = rand64();
+        }
+    }
+}
+
+static void blob_synthetic(struct blob *blob, size_t len)
+{
+    blob_init(blob);
+    blob->len = len;
+    blob->data = malloc_strict(len);
+    fill(blob->data, len);
+}
+
+static bool wanted(char const *name)
+{
+    return !filter || strstr(name, filter);
+}
+
+static void report(char const *name, size_t size, size_t ops, uint64_t us, size_t bytes)
+{
+    printf("%s    {\"name\": \"%s\", \"size\": %zu, \"ops\": %zu, \"ns_per_op\": %.1f, \"mb_per_s\": %.1f}",
+            first ? "" : ",\n", name, size, ops,
+            ops ? 1e3 * us / ops : 0.,
+            us ? (double) bytes / us : 0.);
+    first = false;
+    fflush(stdout);
+}
+
+
+static void bench_insert_delete(size_t size)
+{
+    static char const *where[] = {"start", "middle", "end"};
+    char name[0x40];
+
+    for (size_t w = 0; w < 3; ++w) {
+        struct blob blob;
+        size_t ops = 0;
+        byte b = 0x42;
+
+        snprintf(name, sizeof(name), "blob_insert_%s", where[w]);
+        if (!wanted(name) && !wanted("blob_delete"))
+            continue;
+
+        blob_synthetic(&blob, size);
+
+        uint64_t t = monotonic_microtime(), dt;
+        do {
+            for (size_t i = 0; i < 16; ++i, ++ops)
+                blob_insert(&blob, w * (blob.len / 2), &b, 1, true);
+        } while ((dt = monotonic_microtime() - t) < MIN_TIME);
+        report(name, size, ops, dt, ops * (w == 2 ? 1 : size - w * (size / 2)));
+
+        snprintf(name, sizeof(name), "blob_delete_%s", where[w]);
+        size_t n = ops;
+        t = monotonic_microtime();
+        for (size_t i = 0; i < n; ++i)
+            blob_delete(&blob, w * ((blob.len - 1) / 2), 1, true);
+        dt = monotonic_microtime() - t;
+        report(name, size, n, dt, n * (w == 2 ? 1 : size - w * (size / 2)));
+
+        blob_free(&blob);
+    }
+}
+
+static void bench_history(size_t size)
+{
+    struct blob blob;
+    size_t const n = 100000, len = 16;
+    byte buf[16];
+    uint64_t t;
+
+    if (!wanted("history"))
+        return;
+
+    blob_synthetic(&blob, size);
+    memset(buf, 0xcc, sizeof(buf));
+
+    t = monotonic_microtime();
+    for (size_t i = 0; i < n; ++i)
+        blob_replace(&blob, rand64() % (size - len), buf, len, true);
+    report("history_save", size, n, monotonic_microtime() - t, n * len);
+
+    t = monotonic_microtime();
+    for (size_t i = 0; i < n; ++i)
+        blob_undo(&blob, NULL);
+    report("history_step_undo", size, n, monotonic_microtime() - t, n * len);
+
+    t = monotonic_microtime();
+    for (size_t i = 0; i < n; ++i)
+        blob_redo(&blob, NULL);
+    report("history_step_redo", size, n, monotonic_microtime() - t, n * len);
+
+    blob_free(&blob);
+}
+
+/* full scans for needles that do not occur */
+static void bench_search(size_t size)
+{
+    static const struct {
+        char const *name;
+        size_t len;
+    } needles[] = {
+        {"short", 4},
+        {"long", 64},
+    };
+    struct blob blob;
+    byte needle[64];
+    char name[0x40];
+
+    blob_synthetic(&blob, size);
+
+    for (size_t k = 0; k < sizeof(needles) / sizeof(*needles); ++k) {
+        /* bytes that appear in the text, but never in this order */
+        for (size_t i = 0; i < needles[k].len; ++i)
+            needle[i] = "qzxj"[i % 4];
+
+        for (ssize_t dir = +1; dir >= -1; dir -= 2) {
+            snprintf(name, sizeof(name), "blob_search_rare_%s_%s", needles[k].name, dir > 0 ? "fwd" : "bwd");
+            if (!wanted(name))
+                continue;
+            size_t ops = 0;
+            uint64_t t = monotonic_microtime(), dt;
+            do {
+                if (blob_search(&blob, needle, needles[k].len, dir > 0 ? 0 : size - 1, dir) >= 0)
+                    die("needle should not occur");
+                ++ops;
+            } while ((dt = monotonic_microtime() - t) < MIN_TIME);
+            report(name, size, ops, dt, ops * size);
+        }
+    }
+
+    /* visit all occurrences of a frequent needle */
+    for (ssize_t dir = +1; dir >= -1; dir -= 2) {
+        snprintf(name, sizeof(name), "blob_search_common_%s", dir > 0 ? "fwd" : "bwd");
+        if (!wanted(name))
+            continue;
+        size_t ops = 0;
+        ssize_t pos = dir > 0 ? 0 : size - 1, first_hit = -1;
+        uint64_t t = monotonic_microtime(), dt = 0;
+        do {
+            pos = blob_search(&blob, (byte const *) "the ", 4, pos, dir);
+            if (pos < 0 || pos == first_hit)
+                break;
+            if (first_hit < 0)
+                first_hit = pos;
+            pos = (pos + size + dir) % size;
+            ++ops;
+        } while ((dt = monotonic_microtime() - t) < 10 * MIN_TIME);
+        report(name, size, ops, dt, size);
+    }
+
+    /* the other search modes */
+    struct search S;
+    search_init(&S);
+    for (size_t m = 0; m < 4; ++m) {
+        static char const *modes[] = {"nocase", "value_u32", "value_f64_tol", "approx"};
+        snprintf(name, sizeof(name), "search_%s", modes[m]);
+        if (!wanted(name))
+            continue;
+        switch (m) {
+        case 0: search_nocase(&S, (byte const *) "qzxjqzxjqzxj", 12, 1); break;
+        case 1: search_value(&S, "u32", "0x71c0ffee", NULL); break;
+        case 2: search_value(&S, "f64", "1234.5", "1e-6"); break;
+        case 3: search_approx(&S, (byte const *) "qzxjqzxjqzxjqzxj", 16, 2, false); break;
+        }
+        size_t ops = 0;
+        uint64_t t = monotonic_microtime(), dt;
+        do {
+            search_next(&S, &blob, 0, +1);
+            ++ops;
+        } while ((dt = monotonic_microtime() - t) < MIN_TIME);
+        report(name, size, ops, dt, ops * size);
+    }
+    search_free(&S);
+
+    blob_free(&blob);
+}
+
+/* blob_save() on a large mmap()ed file with a few dirty pages */
+static void bench_save_sparse(void)
+{
+    char filename[] = "/tmp/hyx-bench-XXXXXX";
+    size_t const size = CONFIG_LARGE_FILESIZE, n = 1000;
+    struct blob blob;
+    int fd;
+
+    if (!wanted("blob_save_sparse"))
+        return;
+
+    if (0 > (fd = mkstemp(filename)))
+        pdie("mkstemp");
+    if (ftruncate(fd, size) || close(fd))
+        pdie("ftruncate");
+
+    blob_init(&blob);
+    blob_load(&blob, filename);
+    if (blob.alloc != BLOB_MMAP)
+        die("expected a memory-mapped blob");
+
+    for (size_t i = 0; i < n; ++i) {
+        byte b = i;
+        blob_replace(&blob, rand64() % size, &b, 1, false);
+    }
+
+    uint64_t t = monotonic_microtime();
+    if (blob_save(&blob, NULL) != BLOB_SAVE_OK)
+        die("could not save");
+    report("blob_save_sparse", size, 1, monotonic_microtime() - t, size);
+
+    blob_free(&blob);
+    unlink(filename);
+}
+
+static void bench_load_stream(size_t size)
+{
+    struct blob blob;
+    int fds[2];
+    pid_t pid;
+    FILE *fp;
+
+    if (!wanted("blob_load_stream"))
+        return;
+
+    if (pipe(fds))
+        pdie("pipe");
+    if (0 > (pid = fork()))
+        pdie("fork");
+
+    if (!pid) {
+        byte *buf = malloc_strict(MiB);
+        fill(buf, MiB);
+        close(fds[0]);
+        for (size_t i = 0; i < size; i += MiB)
+            for (size_t j = 0, r; j < MiB; j += r)
+                if (0 >= (ssize_t) (r = write(fds[1], buf + j, MiB - j)))
+                    _exit(EXIT_FAILURE);
+        _exit(EXIT_SUCCESS);
+    }
+
+    close(fds[1]);
+    if (!(fp = fdopen(fds[0], "r")))
+        pdie("fdopen");
+
+    blob_init(&blob);
+    uint64_t t = monotonic_microtime();
+    blob_load_stream(&blob, fp);
+    report("blob_load_stream", size, 1, monotonic_microtime() - t, blob_length(&blob));
+
+    fclose(fp);
+    waitpid(pid, NULL, 0);
+    blob_free(&blob);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1)
+        filter = argv[1];
+
+    printf("{\n  \"benchmarks\": [\n");
+
+    for (size_t size = MiB; size <= 64 * MiB; size *= 8)
+        bench_insert_delete(size);
+    bench_history(64 * MiB);
+    bench_search(64 * MiB);
+    bench_save_sparse();
+    bench_load_stream(256 * MiB);
+
+    printf("\n  ]\n}\n");
+}
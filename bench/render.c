@@ -0,0 +1,271 @@
+/*
+ * Headless rendering benchmark.
+ *
+ * Runs hyx on a pseudo-terminal of fixed size, replays scripted navigation,
+ * editing, searches and saves, and measures the time from sending a key
+ * until the frame it causes has arrived completely (frames end with the
+ * synchronized-update escape).  Prints the results as JSON on stdout.
+ *
+ * Also serves as the training workload for "make MODE=pgo".
+ *
+ * usage: bench/render path/to/hyx [columns rows]
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+
+#define FILE_SIZE (4 << 20)
+#define TIMEOUT 1000 /* milliseconds */
+
+static char const frame_end[] = "\x1b[?2026l";
+
+static int master = -1;
+static pid_t child;
+static char filename[] = "/tmp/hyx-bench-XXXXXX";
+
+struct scenario {
+    char const *name;
+    char const *keys;  /* sent one at a time... */
+    unsigned batch;  /* ...or all at once, causing this many frames */
+    size_t repeat;
+    bool resize;  /* alternate terminal sizes instead of sending keys */
+
+    size_t frames, timeouts, bytes;
+    uint64_t *lat;
+};
+
+static struct scenario scenarios[] = {
+    {.name = "page_down",    .keys = "\x04", .repeat = 200},
+    {.name = "page_up",      .keys = "\x15", .repeat = 100},
+    {.name = "cursor_right", .keys = "l", .repeat = 300},
+    {.name = "cursor_down",  .keys = "j", .repeat = 100},
+    {.name = "cursor_left",  .keys = "h", .repeat = 300},
+    {.name = "selection",    .keys = "vjjjjlllll\x1b", .repeat = 20},
+    {.name = "insert",       .keys = "i4142434445i", .repeat = 20},
+    {.name = "search_text",  .keys = "/s hyx\r", .batch = 2, .repeat = 20},
+    {.name = "search_next",  .keys = "n", .repeat = 100},
+    {.name = "search_nocase", .keys = "/si BENCHMARK\r", .batch = 2, .repeat = 10},
+    {.name = "search_miss",  .keys = "/x 0102030405\r", .batch = 2, .repeat = 10},
+    {.name = "save",         .keys = ":w\r", .batch = 2, .repeat = 10},
+    {.name = "resize",       .resize = true, .repeat = 20},
+};
+
+static unsigned cols = 160, rows = 48;
+
+static void die(char const *s)
+{
+    perror(s);
+    if (child > 0)
+        kill(child, SIGKILL);
+    unlink(filename);
+    exit(EXIT_FAILURE);
+}
+
+static uint64_t microtime(void)
+{
+    struct timespec t;
+    if (clock_gettime(CLOCK_MONOTONIC, &t))
+        die("clock_gettime");
+    return (uint64_t) t.tv_sec * 1000000 + t.tv_nsec / 1000;
+}
+
+static void make_file(void)
+{
+    static uint8_t buf[FILE_SIZE];
+    uint64_t x = 0x2545f4914f6cdd1d;
+    int fd;
+
+    /* zero runs, text and noise */
+    for (size_t i = 0; i < sizeof(buf); ++i) {
+        x ^= x << 13, x ^= x >> 7, x ^= x << 17;
+        switch (i / 0x1000 % 4) {
+        case 0: buf[i] = 0; break;
+        case 1: buf[i] = "hyx benchmark text "[i % 19]; break;
+        default: buf[i] = x;
+        }
+    }
+
+    if (0 > (fd = mkstemp(filename)))
+        die("mkstemp");
+    if (write(fd, buf, sizeof(buf)) != sizeof(buf) || close(fd))
+        die("write");
+}
+
+static void set_size(unsigned c, unsigned r)
+{
+    struct winsize ws = {.ws_row = r, .ws_col = c};
+    if (ioctl(master, TIOCSWINSZ, &ws))
+        die("ioctl");
+}
+
+static void spawn(char const *hyx)
+{
+    char const *slave;
+
+    if (0 > (master = posix_openpt(O_RDWR | O_NOCTTY)))
+        die("posix_openpt");
+    if (grantpt(master) || unlockpt(master) || !(slave = ptsname(master)))
+        die("ptsname");
+    set_size(cols, rows);
+
+    if (0 > (child = fork()))
+        die("fork");
+
+    if (!child) {
+        int fd;
+        if (0 > setsid() || 0 > (fd = open(slave, O_RDWR)))
+            _exit(EXIT_FAILURE);
+        dup2(fd, 0), dup2(fd, 1), dup2(fd, 2);
+        if (fd > 2)
+            close(fd);
+        setenv("TERM", "xterm-256color", 1);
+        execl(hyx, hyx, filename, (char *) NULL);
+        _exit(EXIT_FAILURE);
+    }
+}
+
+/* reads until the end of a frame; false on timeout */
+static bool await_frame(size_t *bytes)
+{
+    uint64_t deadline = microtime() + TIMEOUT * 1000;
+    size_t matched = 0;
+    char buf[0x10000];
+
+    while (true) {
+        struct pollfd pfd = {.fd = master, .events = POLLIN};
+        uint64_t t = microtime();
+        ssize_t n;
+
+        if (t >= deadline || 0 >= poll(&pfd, 1, (deadline - t + 999) / 1000))
+            return false;
+        if (0 >= (n = read(master, buf, sizeof(buf))))
+            return false;
+        *bytes += n;
+
+        for (ssize_t i = 0; i < n; ++i) {
+            matched = buf[i] == frame_end[matched] ? matched + 1 : buf[i] == frame_end[0];
+            if (matched == sizeof(frame_end) - 1)
+                return true;
+        }
+    }
+}
+
+static void step(struct scenario *S, char const *keys, size_t len, unsigned c, unsigned r)
+{
+    size_t bytes = 0;
+    uint64_t t = microtime();
+
+    if (S->resize)
+        set_size(c, r);
+    else if (write(master, keys, len) != (ssize_t) len)
+        die("write");
+
+    for (unsigned i = 0; i < (S->batch ? S->batch : 1); ++i) {
+        if (!await_frame(&bytes)) {
+            ++S->timeouts;
+            return;
+        }
+    }
+
+    S->lat[S->frames++] = microtime() - t;
+    S->bytes += bytes;
+}
+
+static int cmp(void const *x, void const *y)
+{
+    uint64_t a = *(uint64_t const *) x, b = *(uint64_t const *) y;
+    return (a > b) - (a < b);
+}
+
+static uint64_t percentile(uint64_t const *v, size_t n, unsigned p)
+{
+    return n ? v[(n - 1) * p / 100] : 0;
+}
+
+static void print_stats(char const *name, uint64_t *lat, size_t frames, size_t timeouts, size_t bytes, bool last)
+{
+    qsort(lat, frames, sizeof(*lat), cmp);
+    printf("    {\"name\": \"%s\", \"frames\": %zu, \"timeouts\": %zu, ", name, frames, timeouts);
+    printf("\"latency_us\": {\"p50\": %llu, \"p90\": %llu, \"p99\": %llu, \"max\": %llu}, ",
+            (unsigned long long) percentile(lat, frames, 50),
+            (unsigned long long) percentile(lat, frames, 90),
+            (unsigned long long) percentile(lat, frames, 99),
+            (unsigned long long) percentile(lat, frames, 100));
+    printf("\"bytes\": %zu, \"bytes_per_frame\": %zu}%s\n", bytes, frames ? bytes / frames : 0, last ? "" : ",");
+}
+
+int main(int argc, char **argv)
+{
+    size_t const n = sizeof(scenarios) / sizeof(*scenarios);
+    size_t total = 0, frames = 0, timeouts = 0, bytes = 0;
+    uint64_t *all;
+
+    if (argc != 2 && argc != 4) {
+        fprintf(stderr, "usage: %s path/to/hyx [columns rows]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (argc == 4) {
+        cols = strtoul(argv[2], NULL, 0);
+        rows = strtoul(argv[3], NULL, 0);
+    }
+
+    make_file();
+    spawn(argv[1]);
+
+    if (!await_frame(&bytes))
+        die("no initial frame");
+    bytes = 0;
+
+    for (size_t i = 0; i < n; ++i) {
+        struct scenario *S = &scenarios[i];
+        size_t keys = S->resize || S->batch ? 1 : strlen(S->keys);
+        if (!(S->lat = malloc(S->repeat * keys * sizeof(*S->lat))))
+            die("malloc");
+        for (size_t j = 0; j < S->repeat; ++j) {
+            if (S->resize)
+                step(S, NULL, 0, cols - 20 * !(j % 2), rows - 8 * !(j % 2));
+            else if (S->batch)
+                step(S, S->keys, strlen(S->keys), 0, 0);
+            else
+                for (size_t k = 0; k < keys; ++k)
+                    step(S, S->keys + k, 1, 0, 0);
+        }
+        total += S->repeat * keys;
+    }
+
+    if (write(master, ":q!\n", 4) != 4)
+        die("write");
+    waitpid(child, NULL, 0);
+    unlink(filename);
+
+    if (!(all = malloc(total * sizeof(*all))))
+        die("malloc");
+
+    printf("{\n  \"columns\": %u, \"rows\": %u, \"file_size\": %u,\n", cols, rows, FILE_SIZE);
+    printf("  \"scenarios\": [\n");
+    for (size_t i = 0; i < n; ++i) {
+        struct scenario *S = &scenarios[i];
+        memcpy(all + frames, S->lat, S->frames * sizeof(*all));
+        frames += S->frames, timeouts += S->timeouts, bytes += S->bytes;
+        print_stats(S->name, S->lat, S->frames, S->timeouts, S->bytes, i + 1 == n);
+        free(S->lat);
+    }
+    printf("  ],\n  \"total\":\n");
+    print_stats("total", all, frames, timeouts, bytes, true);
+    printf("}\n");
+
+    free(all);
+}
@@ -11,29 +11,198 @@
 #include <sys/mman.h>
 
 #include "history.h"
+#include "stats.h"
+#include "trace.h"
+
+/* what holes read as; lookups inside a hole return spans of this */
+#define ZERO_SPAN 0x10000
+static byte const zeros[ZERO_SPAN];
+
+/* blob_fill() repeats a pattern up to this much, then copies that */
+#define FILL_BLOCK 0x10000
 
 void blob_init(struct blob *blob)
 {
+    pthread_rwlockattr_t attr;
+
     memset(blob, 0, sizeof(*blob));
     history_init(&blob->undo);
     history_init(&blob->redo);
+
+    /* edits must not starve behind a stream of background readers */
+    if (pthread_rwlockattr_init(&attr))
+        die("pthread_rwlockattr_init");
+#ifdef __GLIBC__
+    pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+    if (pthread_rwlock_init(&blob->lock, &attr))
+        die("pthread_rwlock_init");
+    pthread_rwlockattr_destroy(&attr);
 }
 
-void blob_replace(struct blob *blob, size_t pos, byte const *data, size_t len, bool save_history)
+static void write_lock(struct blob *blob)
 {
-    assert(pos + len <= blob->len);
+    if (pthread_rwlock_wrlock(&blob->lock))
+        die("pthread_rwlock_wrlock");
+}
+
+/* tells the observers, then releases the lock */
+static void write_unlock(struct blob *blob, size_t pos, size_t old_len, size_t new_len)
+{
+    for (struct blob_observer *o = blob->observers; o; o = o->next)
+        o->changed(o->arg, pos, old_len, new_len);
+    pthread_rwlock_unlock(&blob->lock);
+}
+
+void blob_observe(struct blob *blob, struct blob_observer *observer)
+{
+    observer->next = blob->observers;
+    blob->observers = observer;
+}
+
+void blob_unobserve(struct blob *blob, struct blob_observer *observer)
+{
+    for (struct blob_observer **o = &blob->observers; *o; o = &(*o)->next)
+        if (*o == observer) {
+            *o = observer->next;
+            return;
+        }
+}
+
+/* of the dirty bitmap, one bit per 4 KiB page */
+static size_t dirty_words(struct blob const *blob)
+{
+    return ((blob->len + 0xfff) / 0x1000 + 63) / 64;
+}
+
+/* first hole ending after pos, or the end of the list */
+static size_t hole_index(struct blob const *blob, size_t pos)
+{
+    size_t lo = 0, hi = blob->holes.count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (blob->holes.list[mid].to <= pos)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+static void holes_insert(struct blob *blob, size_t i, size_t from, size_t to)
+{
+    blob->holes.list = realloc_strict(blob->holes.list,
+            ++blob->holes.count * sizeof(*blob->holes.list));
+    memmove(blob->holes.list + i + 1, blob->holes.list + i,
+            (blob->holes.count - 1 - i) * sizeof(*blob->holes.list));
+    blob->holes.list[i] = (struct blob_hole) {from, to};
+}
 
-    if (save_history) {
-        history_free(&blob->redo);
-        history_save(&blob->undo, REPLACE, blob, pos, len);
-        ++blob->saved_dist;
+/* [from, to) was written to */
+static void holes_remove(struct blob *blob, size_t from, size_t to)
+{
+    size_t i = hole_index(blob, from), j = i;
+    struct blob_hole *h = blob->holes.list;
+
+    if (i == blob->holes.count || h[i].from >= to)
+        return;
+
+    if (h[i].from < from && h[i].to > to) {
+        holes_insert(blob, i + 1, to, blob->holes.list[i].to);
+        blob->holes.list[i].to = from;
+        return;
     }
 
+    if (h[i].from < from)
+        h[i++].to = from;
+    for (j = i; j < blob->holes.count && h[j].to <= to; ++j);
+    if (j < blob->holes.count && h[j].from < to)
+        h[j].from = to;
+
+    memmove(h + i, h + j, (blob->holes.count - j) * sizeof(*h));
+    blob->holes.count -= j - i;
+}
+
+/* makes the coming change undoable; for changes applied in pieces without history */
+void blob_remember(struct blob *blob, enum change_type type, size_t pos, size_t len)
+{
+    history_free(&blob->redo);
+    history_save(&blob->undo, type, blob, pos, len);
+    ++blob->saved_dist;
+}
+
+static void mark_dirty(struct blob *blob, size_t pos, size_t len)
+{
     if (blob->dirty)
         for (size_t i = pos / 0x1000; i < (pos + len + 0xfff) / 0x1000; ++i)
-            blob->dirty[i / 8] |= 1 << i % 8;
+            blob->dirty[i / 64] |= (uint64_t) 1 << i % 64;
+}
+
+void blob_replace(struct blob *blob, size_t pos, byte const *data, size_t len, bool save_history)
+{
+    assert(pos + len <= blob->len);
+
+    if (save_history)
+        blob_remember(blob, REPLACE, pos, len);
+
+    write_lock(blob);
 
+    mark_dirty(blob, pos, len);
+    holes_remove(blob, pos, pos + len);
     memcpy(blob->data + pos, data, len);
+
+    write_unlock(blob, pos, len, len);
+}
+
+/* pattern repeated over [pos, pos + len), starting at pos with its first byte */
+void blob_fill(struct blob *blob, size_t pos, size_t len, byte const *pattern, size_t period, bool save_history)
+{
+    byte *p = blob->data + pos;
+    size_t from = pos, to = pos;
+    bool zero = true;
+
+    assert(pos + len <= blob->len);
+    assert(period);
+
+    if (save_history)
+        blob_remember(blob, FILL, pos, len);
+
+    write_lock(blob);
+
+    mark_dirty(blob, pos, len);
+    holes_remove(blob, pos, pos + len);
+
+    /* whole pages of a mapped file: fresh zero pages, without reading the file first */
+    if (blob->alloc == BLOB_MMAP) {
+        size_t page = sysconf(_SC_PAGESIZE);
+        /* no whole page if the range ends before the next page boundary */
+        from = min((pos + page - 1) / page * page, pos + len);
+        to = max(from, (pos + len) / page * page);
+        if (from < to)
+            mmap_strict(blob->data + from, to - from, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+    }
+
+    for (size_t j = 0; j < period; ++j)
+        zero &= !pattern[j];
+
+    if (zero) {
+        memset(p, 0, from - pos);
+        memset(blob->data + to, 0, pos + len - to);
+    }
+    else if (period == 1)
+        memset(p, *pattern, len);
+    else {
+        /* a block of whole periods, then copies of that while it's in the cache */
+        size_t block = min(period, len);
+        memcpy(p, pattern, block);
+        for (; block < min(len, FILL_BLOCK); block *= 2)
+            memcpy(p + block, p, min(block, len - block));
+        for (size_t i = block; i < len; i += block)
+            memcpy(p + i, p, min(block, len - i));
+    }
+
+    write_unlock(blob, pos, len, len);
 }
 
 void blob_insert(struct blob *blob, size_t pos, byte const *data, size_t len, bool save_history)
@@ -43,16 +212,17 @@ void blob_insert(struct blob *blob, size_t pos, byte const *data, size_t len, bo
     assert(len);
     assert(!blob->dirty); /* not implemented */
 
-    if (save_history) {
-        history_free(&blob->redo);
-        history_save(&blob->undo, INSERT, blob, pos, len);
-        ++blob->saved_dist;
-    }
+    if (save_history)
+        blob_remember(blob, INSERT, pos, len);
+
+    write_lock(blob);
 
     blob->data = realloc_strict(blob->data, blob->len += len);
 
     memmove(blob->data + pos + len, blob->data + pos, blob->len - pos - len);
     memcpy(blob->data + pos, data, len);
+
+    write_unlock(blob, pos, 0, len);
 }
 
 void blob_delete(struct blob *blob, size_t pos, size_t len, bool save_history)
@@ -62,14 +232,15 @@ void blob_delete(struct blob *blob, size_t pos, size_t len, bool save_history)
     assert(len);
     assert(!blob->dirty); /* not implemented */
 
-    if (save_history) {
-        history_free(&blob->redo);
-        history_save(&blob->undo, DELETE, blob, pos, len);
-        ++blob->saved_dist;
-    }
+    if (save_history)
+        blob_remember(blob, DELETE, pos, len);
+
+    write_lock(blob);
 
     memmove(blob->data + pos, blob->data + pos + len, (blob->len -= len) - pos);
     blob->data = realloc_strict(blob->data, blob->len);
+
+    write_unlock(blob, pos, len, 0);
 }
 
 void blob_free(struct blob *blob)
@@ -82,6 +253,7 @@ void blob_free(struct blob *blob)
         break;
     case BLOB_MMAP:
         free(blob->dirty);
+        free(blob->holes.list);
         munmap_strict(blob->data, blob->len);
         break;
     }
@@ -90,6 +262,8 @@ void blob_free(struct blob *blob)
 
     history_free(&blob->undo);
     history_free(&blob->redo);
+
+    pthread_rwlock_destroy(&blob->lock);
 }
 
 bool blob_can_move(struct blob const *blob)
@@ -143,16 +317,13 @@ size_t blob_paste(struct blob *blob, size_t pos, enum change_type type)
 #define DD(F,B) (dir > 0 ? (F) : (B))
 
 /* modified Boyer-Moore-Horspool algorithm. */
-static ssize_t blob_search_range(struct blob const *blob, byte const *needle, size_t len, size_t start, ssize_t end, ssize_t dir, size_t tab[256])
+static ssize_t blob_search_range(struct blob const *blob, byte const *needle, size_t len, size_t start, ssize_t end, ssize_t dir, size_t tab[256], bool skip_holes)
 {
     size_t blen = blob_length(blob);
 
     assert(start < blen && end >= -1 && end <= (ssize_t) blen);
     assert(DD((ssize_t) start <= end, end <= (ssize_t) start));
 
-    if (len > DD(end-start, start-end)) /* needle longer than range */
-        return -1;
-
     for (ssize_t i = start; DD(i < end, i > end) ; ) {
 
         if (i + len > blen) {
@@ -162,6 +333,13 @@ static ssize_t blob_search_range(struct blob const *blob, byte const *needle, si
         }
         assert(i >= 0 && i + len <= blen);
 
+        size_t from, to;
+        if (skip_holes && !blob_at(blob, i) && blob_hole(blob, i, &from, &to) && to - i >= len) {
+            /* no window inside the hole can match */
+            i = DD((ssize_t) (to - len + 1), (ssize_t) from - 1);
+            continue;
+        }
+
         bool found = true;
         for (ssize_t j = DD(len-1, 0); found && j >= 0 && (size_t) j < len; j -= dir)
             found = blob_at(blob, i + j) == needle[j];
@@ -176,9 +354,26 @@ static ssize_t blob_search_range(struct blob const *blob, byte const *needle, si
     return -1;
 }
 
+/* the skip table for blob_search_range(); whether holes can be skipped */
+static bool search_prepare(struct blob const *blob, byte const *needle, size_t len, ssize_t dir, size_t tab[256])
+{
+    /* could do preprocessing once per needle/dir pair, but patterns are usually short */
+    for (size_t j = 0; j < 256; ++j)
+        tab[j] = len;
+    for (size_t j = 0; j < len-1; ++j)
+        tab[needle[DD(j, len-1-j)]] = len-1-j;
+
+    bool skip_holes = false;
+    for (size_t j = 0; j < len && blob->holes.count && !skip_holes; ++j)
+        skip_holes = needle[j];
+    return skip_holes;
+}
+
 ssize_t blob_search(struct blob const *blob, byte const *needle, size_t len, size_t start, ssize_t dir)
 {
     size_t blen = blob_length(blob);
+    uint64_t tr = trace_begin();
+    size_t tab[256];
 
     if (!len || len > blen)
         return -1;
@@ -186,17 +381,35 @@ ssize_t blob_search(struct blob const *blob, byte const *needle, size_t len, siz
     assert(start < blen);
     assert(dir == +1 || dir == -1);
 
-    /* could do preprocessing once per needle/dir pair, but patterns are usually short */
+    bool skip_holes = search_prepare(blob, needle, len, dir, tab);
+    ssize_t r = blob_search_range(blob, needle, len, start, DD((ssize_t) blen, -1), dir, tab, skip_holes);
+    if (r < 0)  /* wrap around */
+        r = blob_search_range(blob, needle, len, DD(0, blen-1), start, dir, tab, skip_holes);
+
+    trace_end("blob_search", tr);
+    return r;
+}
+
+/*
+ * Like blob_search(), but only at positions from start up to end (not
+ * included; -1 backward to include 0), without wrapping around.
+ */
+ssize_t blob_search_to(struct blob const *blob, byte const *needle, size_t len, size_t start, ssize_t end, ssize_t dir)
+{
+    size_t blen = blob_length(blob);
+    uint64_t tr = trace_begin();
     size_t tab[256];
-    for (size_t j = 0; j < 256; ++j)
-        tab[j] = len;
-    for (size_t j = 0; j < len-1; ++j)
-        tab[needle[DD(j, len-1-j)]] = len-1-j;
 
-    ssize_t r = blob_search_range(blob, needle, len, start, DD((ssize_t) blen, -1), dir, tab);
-    if (r < 0)  /* wrap around */
-        r = blob_search_range(blob, needle, len, DD(0, blen-1), start, dir, tab);
+    if (!len || len > blen)
+        return -1;
+
+    assert(start < blen);
+    assert(dir == +1 || dir == -1);
+
+    bool skip_holes = search_prepare(blob, needle, len, dir, tab);
+    ssize_t r = blob_search_range(blob, needle, len, start, end, dir, tab, skip_holes);
 
+    trace_end("blob_search", tr);
     return r;
 }
 
@@ -205,8 +418,37 @@ ssize_t blob_search(struct blob const *blob, byte const *needle, size_t len, siz
 
 /* blob_load* functions must be called with a fresh struct from blob_init() */
 
+/* asks the file system where fd has holes */
+static void load_holes(struct blob *blob, int fd)
+{
+    off_t data, hole = 0;
+
+    while ((size_t) hole < blob->len) {
+        if (0 > (data = lseek(fd, hole, SEEK_DATA))) {
+            if (errno != ENXIO)
+                goto fail;  /* not supported */
+            data = blob->len;  /* only a hole left */
+        }
+        if ((size_t) data > blob->len)
+            data = blob->len;
+        if (data > hole)
+            holes_insert(blob, blob->holes.count, hole, data);
+        if ((size_t) data == blob->len)
+            break;
+        if (0 > (hole = lseek(fd, data, SEEK_HOLE)))
+            goto fail;
+    }
+    return;
+
+fail:
+    free(blob->holes.list);
+    blob->holes.list = NULL;
+    blob->holes.count = 0;
+}
+
 void blob_load(struct blob *blob, char const *filename)
 {
+    uint64_t t = monotonic_microtime(), tr = trace_begin();
     struct stat st;
     int fd;
     void *ptr = NULL;
@@ -239,6 +481,9 @@ void blob_load(struct blob *blob, char const *filename)
         die("unsupported file type");
     }
 
+    if ((st.st_mode & S_IFMT) == S_IFREG)
+        load_holes(blob, fd);
+
     if (blob->len)
         ptr = mmap_strict(NULL,
                 blob->len,
@@ -252,16 +497,29 @@ void blob_load(struct blob *blob, char const *filename)
     case BLOB_MMAP:
         assert(ptr);
         blob->data = ptr;
-        if (!(blob->dirty = calloc(((blob->len + 0xfff) / 0x1000 + 7) / 8, sizeof(*blob->dirty))))
+        if (!(blob->dirty = calloc(dirty_words(blob), sizeof(*blob->dirty))))
             pdie("calloc");
         break;
 
     case BLOB_MALLOC:
         blob->data = malloc_strict(blob->len);
         if (ptr) {
-            memcpy(blob->data, ptr, blob->len);
+            /* don't fault in the holes only to copy zeros */
+            size_t from = 0;
+            for (size_t i = 0; i <= blob->holes.count; ++i) {
+                struct blob_hole h = {blob->len, blob->len};
+                if (i < blob->holes.count)
+                    h = blob->holes.list[i];
+                memcpy(blob->data + from, (byte *) ptr + from, h.from - from);
+                memset(blob->data + h.from, 0, h.to - h.from);
+                from = h.to;
+            }
             munmap_strict(ptr, blob->len);
         }
+        /* the list would have to move along with the data */
+        free(blob->holes.list);
+        blob->holes.list = NULL;
+        blob->holes.count = 0;
         break;
 
     default:
@@ -270,10 +528,14 @@ void blob_load(struct blob *blob, char const *filename)
 
     if (close(fd))
         pdie("close");
+
+    stats_since(STAT_LOAD, t);
+    trace_end("blob_load", tr);
 }
 
 void blob_load_stream(struct blob *blob, FILE *fp)
 {
+    uint64_t t = monotonic_microtime(), tr = trace_begin();
     const size_t alloc_size = 0x1000;
     size_t n = 0;
 
@@ -291,10 +553,15 @@ void blob_load_stream(struct blob *blob, FILE *fp)
         n += r;
     }
     blob->data = realloc(blob->data, (blob->len = n));
+
+    stats_since(STAT_LOAD, t);
+    trace_end("blob_load_stream", tr);
 }
 
 enum blob_save_error blob_save(struct blob *blob, char const *filename)
 {
+    uint64_t t = monotonic_microtime(), tr = trace_begin();
+    size_t syscalls = 0;
     int fd;
     struct stat st;
     byte const *ptr;
@@ -322,13 +589,16 @@ enum blob_save_error blob_save(struct blob *blob, char const *filename)
 
     if (fstat(fd, &st))
         pdie("fstat");
+    syscalls += 2;
+
+    bool punch = (st.st_mode & S_IFMT) == S_IFREG;
 
-    if ((st.st_mode & S_IFMT) == S_IFREG && ftruncate(fd, blob->len))
+    if (punch && (++syscalls, ftruncate(fd, blob->len)))
             pdie("ftruncate");
 
     for (size_t i = 0, n; i < blob->len; i += n) {
 
-        if (blob->dirty && !(blob->dirty[i / 0x1000 / 8] & (1 << i / 0x1000 % 8))) {
+        if (blob->dirty && !(blob->dirty[i / 0x1000 / 64] & (uint64_t) 1 << i / 0x1000 % 64)) {
             n = 0x1000 - i % 0x1000;
             continue;
         }
@@ -337,17 +607,38 @@ enum blob_save_error blob_save(struct blob *blob, char const *filename)
         if (blob->dirty)
             n = min(0x1000 - i % 0x1000, n);
 
+        /* holes of the file as loaded stay holes; data is written up to the next one */
+        size_t from, to;
+        if (punch && blob_hole(blob, i, &from, &to)) {
+            size_t z = blob->dirty ? n : to - i;
+            ++syscalls;
+            if (!fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, i, z)) {
+                n = z;
+                continue;
+            }
+            if (errno != EOPNOTSUPP && errno != ENOSYS)
+                pdie("fallocate");
+            punch = false;  /* write the zeros after all */
+        }
+
         if ((ssize_t) i != lseek(fd, i, SEEK_SET))
             pdie("lseek");
 
         if (0 >= (n = write(fd, ptr, n)))
             pdie("write");
+        syscalls += 2;
     }
 
     if (close(fd))
         pdie("close");
 
     blob->saved_dist = 0;
+    if (blob->dirty)
+        memset(blob->dirty, 0, dirty_words(blob) * sizeof(*blob->dirty));
+
+    stats.save_syscalls = syscalls + 1;
+    stats_since(STAT_SAVE, t);
+    trace_end("blob_save", tr);
 
     return BLOB_SAVE_OK;
 }
@@ -357,20 +648,182 @@ bool blob_is_saved(struct blob const *blob)
     return !blob->saved_dist;
 }
 
+/* pages written since the last save; 0 without a dirty bitmap */
+size_t blob_dirty_pages(struct blob const *blob)
+{
+    size_t n = 0;
+    if (blob->dirty)
+        for (size_t i = 0; i < dirty_words(blob); ++i)
+            n += __builtin_popcountll(blob->dirty[i]);
+    return n;
+}
+
+/* first page >= i (dir > 0) or last page < i (dir < 0) that is dirty (or clean), or -1 */
+static ssize_t dirty_find(struct blob const *blob, size_t i, ssize_t dir, bool dirty)
+{
+    size_t const pages = (blob->len + 0xfff) / 0x1000;
+    uint64_t const flip = dirty ? 0 : ~(uint64_t) 0;
+    uint64_t m;
+
+    if (dir > 0) {
+        for (size_t w; i < pages; i = (w + 1) * 64) {
+            w = i / 64;
+            if ((m = (blob->dirty[w] ^ flip) & ~(uint64_t) 0 << i % 64)) {
+                i = w * 64 + __builtin_ctzll(m);
+                return i < pages ? (ssize_t) i : -1;
+            }
+        }
+    }
+    else {
+        for (size_t w; i; i = w * 64) {
+            w = (i - 1) / 64;
+            if ((m = (blob->dirty[w] ^ flip) & ~(uint64_t) 0 >> (63 - (i - 1) % 64)))
+                return w * 64 + 63 - __builtin_clzll(m);
+        }
+    }
+
+    return -1;
+}
+
+/* the run of dirty pages around page i */
+static void dirty_run(struct blob const *blob, size_t i, struct blob_extent *ext)
+{
+    ssize_t s = dirty_find(blob, i, -1, false), e = dirty_find(blob, i, +1, false);
+
+    ext->from = (s + 1) * 0x1000;
+    ext->to = e < 0 ? blob->len : min((size_t) e * 0x1000, blob->len);
+}
+
+/* for blobs that can move, replays the history back to the last save */
+static size_t history_changes(struct blob const *blob, struct blob_extent **list)
+{
+    size_t count;
+
+    if (!blob->saved_dist) {
+        *list = NULL;
+        return 0;
+    }
+
+    if (!history_extents(blob->saved_dist > 0 ? blob->undo : blob->redo,
+                blob->saved_dist > 0 ? (size_t) blob->saved_dist : (size_t) -blob->saved_dist,
+                list, &count)) {
+        /* the saved state is gone from the history */
+        *list = malloc_strict(sizeof(**list));
+        (*list)->from = 0;
+        (*list)->to = blob->len;
+        count = 1;
+    }
+
+    return count;
+}
+
+/* sorted list of the extents that differ from the file as last saved */
+size_t blob_changes(struct blob const *blob, struct blob_extent **list)
+{
+    struct blob_extent ext;
+    size_t count = 0;
+    ssize_t i = 0;
+
+    if (!blob->dirty)
+        return history_changes(blob, list);
+
+    *list = NULL;
+    while ((i = dirty_find(blob, i, +1, true)) >= 0) {
+        dirty_run(blob, i, &ext);
+        *list = realloc_strict(*list, ++count * sizeof(**list));
+        (*list)[count - 1] = ext;
+        i = (ext.to + 0xfff) / 0x1000;
+    }
+
+    return count;
+}
+
+/* the next (dir > 0) or previous extent starting after or before pos */
+bool blob_next_change(struct blob const *blob, size_t pos, ssize_t dir, struct blob_extent *ext)
+{
+    uint64_t tr = trace_begin();
+    bool found = false;
+
+    if (!blob->dirty) {
+        struct blob_extent *list;
+        size_t count = history_changes(blob, &list), i;
+        if (dir > 0) {
+            for (i = 0; i < count && list[i].from <= pos; ++i);
+            found = i < count;
+        }
+        else {
+            for (i = count; i && list[i - 1].from >= pos; --i);
+            if ((found = i > 0))
+                --i;
+        }
+        if (found)
+            *ext = list[i];
+        free(list);
+    }
+    else if (blob->len) {
+        ssize_t i;
+        pos = min(pos, blob->len - 1);
+        if (dir > 0) {
+            /* past the run we're in */
+            i = pos / 0x1000 + 1;
+            if (dirty_find(blob, i, -1, true) == i - 1)
+                i = dirty_find(blob, i, +1, false);
+            if (i >= 0 && (i = dirty_find(blob, i, +1, true)) >= 0)
+                found = true;
+        }
+        else if (pos) {
+            i = (pos - 1) / 0x1000;
+            if (dirty_find(blob, i + 1, -1, true) != i)
+                i = dirty_find(blob, i, -1, true);
+            found = i >= 0;
+        }
+        if (found)
+            dirty_run(blob, i, ext);
+    }
+
+    trace_end("next_change", tr);
+    return found;
+}
+
 byte const *blob_lookup(struct blob const *blob, size_t pos, size_t *len)
 {
     assert(pos < blob->len);
 
+    if (blob->holes.count) {
+        size_t i = hole_index(blob, pos);
+        struct blob_hole const *h = blob->holes.list + i;
+        if (i < blob->holes.count && h->from <= pos) {
+            if (len)
+                *len = min(h->to - pos, ZERO_SPAN);
+            return zeros;
+        }
+        if (len)
+            *len = (i < blob->holes.count ? h->from : blob->len) - pos;
+        return blob->data + pos;
+    }
+
     if (len)
         *len = blob->len - pos;
     return blob->data + pos;
 }
 
+/* whether pos lies in a hole, and if so, where that starts and ends */
+bool blob_hole(struct blob const *blob, size_t pos, size_t *from, size_t *to)
+{
+    size_t i = hole_index(blob, pos);
+
+    if (i == blob->holes.count || blob->holes.list[i].from > pos)
+        return false;
+    *from = blob->holes.list[i].from;
+    *to = blob->holes.list[i].to;
+    return true;
+}
+
 void blob_read_strict(struct blob const *blob, size_t pos, byte *buf, size_t len)
 {
     byte const *ptr;
     for (size_t i = 0, n; i < len; i += n) {
-        ptr = blob_lookup(blob, pos, &n);
+        ptr = blob_lookup(blob, pos + i, &n);
         memcpy(buf + i, ptr, (n = min(len - i, n)));
     }
 }
@@ -3,11 +3,31 @@
 
 #include "common.h"
 
+#include <assert.h>
+#include <pthread.h>
+
 enum blob_alloc {
     BLOB_MALLOC = 0,
     BLOB_MMAP,
 };
 
+/* told after every change: old_len bytes at pos were replaced by new_len */
+struct blob_observer {
+    void (*changed)(void *arg, size_t pos, size_t old_len, size_t new_len);
+    void *arg;
+    struct blob_observer *next;
+};
+
+/* known to read as zeros, e.g. holes of a sparse file */
+struct blob_hole {
+    size_t from, to;
+};
+
+/* modified since the last save; empty where bytes were only removed */
+struct blob_extent {
+    size_t from, to;
+};
+
 struct blob {
     enum blob_alloc alloc;
 
@@ -16,7 +36,14 @@ struct blob {
 
     char *filename;
 
-    uint8_t *dirty;
+    /* one bit per 4 KiB page written since the last save */
+    uint64_t *dirty;
+
+    /* sorted; only for blobs that cannot move */
+    struct {
+        size_t count;
+        struct blob_hole *list;
+    } holes;
 
     struct change *undo, *redo;
     ssize_t saved_dist;
@@ -25,16 +52,27 @@ struct blob {
         size_t len;
         byte *data;
     } clipboard;
+
+    struct blob_observer *observers;
+
+    /* Only the main thread modifies a blob, holding this for writing.
+     * Other threads must hold it for reading while looking at the data. */
+    pthread_rwlock_t lock;
 };
 
 void blob_init(struct blob *blob);
+void blob_remember(struct blob *blob, enum change_type type, size_t pos, size_t len);
 void blob_replace(struct blob *blob, size_t pos, byte const *data, size_t len, bool save_history);
+void blob_fill(struct blob *blob, size_t pos, size_t len, byte const *pattern, size_t period, bool save_history);
 void blob_insert(struct blob *blob, size_t pos, byte const *data, size_t len, bool save_history);
 void blob_delete(struct blob *blob, size_t pos, size_t len, bool save_history);
 void blob_free(struct blob *blob);
 
 bool blob_can_move(struct blob const *blob);
 
+void blob_observe(struct blob *blob, struct blob_observer *observer);
+void blob_unobserve(struct blob *blob, struct blob_observer *observer);
+
 bool blob_undo(struct blob *blob, size_t *pos);
 bool blob_redo(struct blob *blob, size_t *pos);
 
@@ -42,6 +80,7 @@ void blob_yank(struct blob *blob, size_t pos, size_t len);
 size_t blob_paste(struct blob *blob, size_t pos, enum change_type type);
 
 ssize_t blob_search(struct blob const *blob, byte const *needle, size_t len, size_t start, ssize_t dir);
+ssize_t blob_search_to(struct blob const *blob, byte const *needle, size_t len, size_t start, ssize_t end, ssize_t dir);
 
 void blob_load(struct blob *blob, char const *filename);
 void blob_load_stream(struct blob *blob, FILE *fp);
@@ -53,12 +92,16 @@ enum blob_save_error {
     BLOB_SAVE_BUSY,
 } blob_save(struct blob *blob, char const *filename);
 bool blob_is_saved(struct blob const *blob);
+size_t blob_dirty_pages(struct blob const *blob);
+size_t blob_changes(struct blob const *blob, struct blob_extent **list);
+bool blob_next_change(struct blob const *blob, size_t pos, ssize_t dir, struct blob_extent *ext);
 
 static inline size_t blob_length(struct blob const *blob)
     { return blob->len; }
 byte const *blob_lookup(struct blob const *blob, size_t pos, size_t *len);
+bool blob_hole(struct blob const *blob, size_t pos, size_t *from, size_t *to);
 static inline byte blob_at(struct blob const *blob, size_t pos)
-    { return *blob_lookup(blob, pos, NULL); }
+    { assert(pos < blob->len); return blob->holes.count ? *blob_lookup(blob, pos, NULL) : blob->data[pos]; }
 void blob_read_strict(struct blob const *blob, size_t pos, byte *buf, size_t len);
 
 #endif
@@ -4,6 +4,7 @@
 #include "common.h"
 
 #include <errno.h>
+#include <signal.h>
 #include <time.h>
 #include <unistd.h>
 #include <sys/mman.h>
@@ -71,3 +72,91 @@ uint64_t monotonic_microtime(void)
     return (uint64_t) t.tv_sec * 1000000 + t.tv_nsec / 1000;
 }
 
+unsigned cpu_count(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? n : 1;
+}
+
+/* signals are left to the main thread */
+void thread_create_strict(pthread_t *thread, void *(*fun)(void *), void *arg)
+{
+    sigset_t all, old;
+    int err;
+
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    err = pthread_create(thread, NULL, fun, arg);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if (err) {
+        errno = err;
+        pdie("pthread_create");
+    }
+}
+
+/* threads for parallel_blocks(), the calling one included */
+#define PARALLEL_THREADS 8
+
+struct parallel {
+    size_t blocks;
+    bool (*fun)(void *, size_t);
+    void *arg;
+
+    pthread_mutex_t lock;
+    size_t next;
+    size_t stop;  /* no block after this one is started */
+};
+
+static void parallel_work(struct parallel *P, void (*progress)(void *, size_t, size_t), void *arg)
+{
+    while (true) {
+        pthread_mutex_lock(&P->lock);
+        size_t i = P->next;
+        bool done = i >= P->blocks || i > P->stop;
+        P->next += !done;
+        pthread_mutex_unlock(&P->lock);
+        if (done)
+            break;
+
+        if (!P->fun(P->arg, i)) {
+            pthread_mutex_lock(&P->lock);
+            P->stop = min(P->stop, i);
+            pthread_mutex_unlock(&P->lock);
+        }
+
+        if (progress)
+            progress(arg, i + 1, P->blocks);
+    }
+}
+
+static void *parallel_worker(void *arg)
+{
+    parallel_work(arg, NULL, NULL);
+    return NULL;
+}
+
+/*
+ * Calls fun(arg, i) for the blocks 0 <= i < blocks on several threads,
+ * handing them out in order.  Once a call returns false, no later block is
+ * started.  The calling thread works along and reports progress (if given)
+ * in blocks.
+ */
+void parallel_blocks(size_t blocks, bool (*fun)(void *arg, size_t i), void *arg,
+        void (*progress)(void *arg, size_t done, size_t total), void *progress_arg)
+{
+    struct parallel P = {.blocks = blocks, .fun = fun, .arg = arg, .stop = SIZE_MAX};
+    unsigned nthreads = min(min(cpu_count(), PARALLEL_THREADS), max(blocks, 1));
+    pthread_t threads[PARALLEL_THREADS];
+
+    if (pthread_mutex_init(&P.lock, NULL))
+        die("pthread_mutex_init");
+
+    for (unsigned i = 1; i < nthreads; ++i)
+        thread_create_strict(&threads[i], parallel_worker, &P);
+    parallel_work(&P, progress, progress_arg);
+    for (unsigned i = 1; i < nthreads; ++i)
+        pthread_join(threads[i], NULL);
+
+    pthread_mutex_destroy(&P.lock);
+}
@@ -8,6 +8,7 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <sys/types.h>
+#include <pthread.h>
 
 
 /* round columns to a multiple of this */
@@ -19,6 +20,9 @@
 /* microseconds to wait for the rest of what could be an escape sequence */
 #define CONFIG_WAIT_ESCAPE (10000) // 10 milliseconds
 
+/* minimum microseconds between frames while input is queued up */
+#define CONFIG_FRAME_INTERVAL (1000000 / 60) // 60 frames per second
+
 
 typedef uint8_t byte;
 
@@ -43,12 +47,18 @@ off_t lseek_strict(int fildes, off_t offset, int whence);
 
 uint64_t monotonic_microtime(void);
 
+unsigned cpu_count(void);
+void thread_create_strict(pthread_t *thread, void *(*fun)(void *), void *arg);
+void parallel_blocks(size_t blocks, bool (*fun)(void *arg, size_t i), void *arg,
+        void (*progress)(void *arg, size_t done, size_t total), void *progress_arg);
+
 
 /* history.h */
 enum change_type {
     REPLACE,
     INSERT,
     DELETE,
+    FILL,     /* REPLACE with a short pattern repeated */
 };
 
 /* input.h */
@@ -0,0 +1,335 @@
+
+#define _GNU_SOURCE
+
+#include "diff.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "blob.h"
+#include "trace.h"
+
+#define DIFF_CHUNK ((size_t) 1 << 16)
+
+/* memcmp() this much before looking for the exact position */
+#define DIFF_PIECE 0x1000
+
+/* larger ranges are split into blocks of this size among threads */
+#define DIFF_BLOCK ((size_t) 4 << 20)
+
+/* needle length and search radius for realigning */
+#define ALIGN_NEEDLE 32
+#define ALIGN_RANGE ((size_t) 1 << 20)
+
+/* how far b reaches in a's positions */
+static size_t b_extent(struct diff const *D)
+{
+    size_t blen = blob_length(D->b);
+    if (D->shift < 0)
+        return blen + (size_t) -D->shift;
+    return blen > (size_t) D->shift ? blen - D->shift : 0;
+}
+
+/* where both sides have bytes: [lo, hi); everything else up to end differs */
+static void bounds(struct diff const *D, size_t *lo, size_t *hi, size_t *end)
+{
+    size_t alen = blob_length(D->a), bext = b_extent(D);
+
+    *lo = D->shift < 0 ? min(alen, (size_t) -D->shift) : 0;
+    *hi = max(*lo, min(alen, bext));
+    if (end)
+        *end = max(alen, bext);
+}
+
+#ifdef __SSE2__
+/* bit j set iff p[j] == q[j] */
+static inline unsigned eq_mask(byte const *p, byte const *q)
+{
+    __m128i x = _mm_loadu_si128((__m128i const *) p);
+    __m128i y = _mm_loadu_si128((__m128i const *) q);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(x, y));
+}
+#endif
+
+/* first (dir > 0) or last j < n with (p[j] == q[j]) == equal */
+static ssize_t find_span(byte const *p, byte const *q, size_t n, ssize_t dir, bool equal)
+{
+#ifdef __SSE2__
+    unsigned const flip = equal ? 0 : 0xffff;
+#endif
+
+    if (dir > 0) {
+        for (size_t j = 0, e; j < n; j = e) {
+            e = j + min(n - j, DIFF_PIECE);
+            if (!equal && !memcmp(p + j, q + j, e - j))
+                continue;
+#ifdef __SSE2__
+            for (; j + 16 <= e; j += 16)
+                if (eq_mask(p + j, q + j) ^ flip)
+                    return j + __builtin_ctz(eq_mask(p + j, q + j) ^ flip);
+#endif
+            for (; j < e; ++j)
+                if ((p[j] == q[j]) == equal)
+                    return j;
+        }
+    }
+    else {
+        for (size_t j = n, s; j > 0; j = s) {
+            s = j - min(j, DIFF_PIECE);
+            if (!equal && !memcmp(p + s, q + s, j - s))
+                continue;
+#ifdef __SSE2__
+            for (; j >= s + 16; j -= 16)
+                if (eq_mask(p + j - 16, q + j - 16) ^ flip)
+                    return j - 16 + 31 - __builtin_clz(eq_mask(p + j - 16, q + j - 16) ^ flip);
+#endif
+            while (j-- > s)
+                if ((p[j] == q[j]) == equal)
+                    return j;
+        }
+    }
+
+    return -1;
+}
+
+/* like find_span() for positions [lo, hi) where both sides have bytes */
+static ssize_t find_range(struct diff const *D, size_t lo, size_t hi, ssize_t dir, bool equal)
+{
+    while (lo < hi) {
+        size_t s = dir > 0 ? lo : hi - min(hi - lo, DIFF_CHUNK);
+        size_t e = dir > 0 ? min(hi, s + DIFF_CHUNK) : hi;
+        ssize_t best = -1, r;
+
+        /* spans of the two blobs needn't line up; backwards, the last hit counts */
+        for (size_t i = s, n, m; i < e; i += n) {
+            byte const *p = blob_lookup(D->a, i, &n);
+            byte const *q = blob_lookup(D->b, i + D->shift, &m);
+            n = min(min(n, m), e - i);
+            if ((r = find_span(p, q, n, dir, equal)) >= 0) {
+                best = i + r;
+                if (dir > 0)
+                    break;
+            }
+        }
+        if (best >= 0)
+            return best;
+
+        if (dir > 0)
+            lo = e;
+        else
+            hi = s;
+    }
+
+    return -1;
+}
+
+/*
+ * Large ranges: blocks are handed out nearest first, and nobody starts on
+ * a block beyond one that already has a hit.  The main thread, the only
+ * one changing blobs, works along and waits for the others to finish.
+ */
+
+struct job {
+    struct diff const *diff;
+    size_t lo, hi;
+    ssize_t dir;
+    bool equal;
+
+    pthread_mutex_t lock;
+    size_t found_block;
+    ssize_t found;
+};
+
+static bool find_block(void *arg, size_t i)
+{
+    struct job *J = arg;
+
+    /* offsets from the end we start at */
+    size_t a = i * DIFF_BLOCK, b = min(a + DIFF_BLOCK, J->hi - J->lo);
+    ssize_t r = J->dir > 0
+        ? find_range(J->diff, J->lo + a, J->lo + b, J->dir, J->equal)
+        : find_range(J->diff, J->hi - b, J->hi - a, J->dir, J->equal);
+
+    if (r < 0)
+        return true;
+
+    pthread_mutex_lock(&J->lock);
+    if (i < J->found_block) {
+        J->found_block = i;
+        J->found = r;
+    }
+    pthread_mutex_unlock(&J->lock);
+    return false;
+}
+
+static ssize_t find(struct diff const *D, size_t lo, size_t hi, ssize_t dir, bool equal)
+{
+    if (lo >= hi)
+        return -1;
+    if (cpu_count() < 2 || hi - lo < 4 * DIFF_BLOCK)
+        return find_range(D, lo, hi, dir, equal);
+
+    struct job J = {
+        .diff = D, .lo = lo, .hi = hi, .dir = dir, .equal = equal,
+        .found_block = SIZE_MAX, .found = -1,
+    };
+    if (pthread_mutex_init(&J.lock, NULL))
+        die("pthread_mutex_init");
+
+    parallel_blocks((hi - lo + DIFF_BLOCK - 1) / DIFF_BLOCK, find_block, &J, NULL, NULL);
+
+    pthread_mutex_destroy(&J.lock);
+    return J.found;
+}
+
+/* first difference at or after from */
+static ssize_t first_diff(struct diff const *D, size_t from)
+{
+    size_t lo, hi, end;
+    ssize_t r;
+
+    bounds(D, &lo, &hi, &end);
+    if (from >= end)
+        return -1;
+    if (from < lo || from >= hi)
+        return from;
+    if ((r = find(D, from, hi, +1, false)) >= 0)
+        return r;
+    return hi < end ? (ssize_t) hi : -1;
+}
+
+/* first equal byte at or after from */
+static ssize_t first_same(struct diff const *D, size_t from)
+{
+    size_t lo, hi;
+
+    bounds(D, &lo, &hi, NULL);
+    return find(D, max(from, lo), hi, +1, true);
+}
+
+/* last difference before to */
+static ssize_t last_diff(struct diff const *D, size_t to)
+{
+    size_t lo, hi, end;
+    ssize_t r;
+
+    bounds(D, &lo, &hi, &end);
+    to = min(to, end);
+    if (!to)
+        return -1;
+    if (to > hi || to <= lo)
+        return to - 1;
+    if ((r = find(D, lo, to, -1, false)) >= 0)
+        return r;
+    return (ssize_t) lo - 1;
+}
+
+/* last equal byte before to */
+static ssize_t last_same(struct diff const *D, size_t to)
+{
+    size_t lo, hi;
+
+    bounds(D, &lo, &hi, NULL);
+    return find(D, lo, min(to, hi), -1, true);
+}
+
+bool diff_at(struct diff const *D, size_t pos)
+{
+    size_t lo, hi, end;
+
+    bounds(D, &lo, &hi, &end);
+    if (pos < lo || pos >= hi)
+        return pos < end;
+    return blob_at(D->a, pos) != blob_at(D->b, pos + D->shift);
+}
+
+/* start of the next (dir > 0) or previous run of differences, or -1 */
+ssize_t diff_next(struct diff const *D, size_t pos, ssize_t dir)
+{
+    uint64_t tr = trace_begin();
+    ssize_t r;
+
+    if (dir > 0) {
+        /* skip the rest of the run we're in */
+        if (diff_at(D, pos) && (r = first_same(D, pos)) >= 0)
+            pos = r;
+        r = diff_at(D, pos) ? -1 : first_diff(D, pos);
+    }
+    else {
+        if (diff_at(D, pos))
+            pos = last_same(D, pos) + 1;
+        if ((r = last_diff(D, pos)) >= 0)
+            r = last_same(D, r) + 1;
+    }
+
+    trace_end("diff_next", tr);
+    return r;
+}
+
+static size_t distance(ssize_t x, ssize_t y)
+{
+    return x > y ? (size_t) (x - y) : (size_t) (y - x);
+}
+
+/* position of needle in hay nearest to around, within ALIGN_RANGE */
+static ssize_t nearest(struct blob const *hay, byte const *needle, size_t len, size_t around)
+{
+    size_t hlen = blob_length(hay);
+    ssize_t best = -1;
+
+    if (!len || len > hlen)
+        return -1;
+    around = min(around, hlen - len);
+
+    /* the matches closest on either side, without looking any further */
+    ssize_t ends[2] = {around > ALIGN_RANGE ? (ssize_t) (around - ALIGN_RANGE - 1) : -1,
+                       min(around + ALIGN_RANGE + 1, hlen)};
+    for (int dir = -1; dir <= 1; dir += 2) {
+        ssize_t r = blob_search_to(hay, needle, len, around, ends[dir > 0], dir);
+        if (r >= 0 && (best < 0 || absdiff(r, around) < absdiff(best, around)))
+            best = r;
+    }
+    return best;
+}
+
+/*
+ * Looks for the bytes after the first difference from pos on one side
+ * close by on the other side, as if they were moved by an insertion or
+ * deletion, and returns the shift that lines them up again.
+ */
+bool diff_align(struct diff const *D, size_t pos, ssize_t *shift)
+{
+    size_t alen = blob_length(D->a), blen = blob_length(D->b);
+    byte needle[ALIGN_NEEDLE];
+    bool found = false;
+    ssize_t q, r;
+
+    if ((q = diff_at(D, pos) ? (ssize_t) pos : first_diff(D, pos)) < 0)
+        return false;
+
+    /* bytes were inserted into b */
+    if ((size_t) q < alen) {
+        size_t n = min(ALIGN_NEEDLE, alen - q);
+        blob_read_strict(D->a, q, needle, n);
+        if ((r = nearest(D->b, needle, n, q + D->shift < 0 ? 0 : q + D->shift)) >= 0) {
+            *shift = r - q;
+            found = true;
+        }
+    }
+
+    /* bytes were inserted into a */
+    size_t bq = q + D->shift;
+    if (q + D->shift >= 0 && bq < blen) {
+        size_t n = min(ALIGN_NEEDLE, blen - bq);
+        blob_read_strict(D->b, bq, needle, n);
+        if ((r = nearest(D->a, needle, n, q)) >= 0) {
+            ssize_t s = (ssize_t) bq - r;
+            if (!found || distance(s, D->shift) < distance(*shift, D->shift))
+                *shift = s;
+            found = true;
+        }
+    }
+
+    return found;
+}
@@ -0,0 +1,18 @@
+#ifndef DIFF_H
+#define DIFF_H
+
+#include "common.h"
+
+struct blob;
+
+/* a[pos] lines up with b[pos + shift]; bytes only one side has differ */
+struct diff {
+    struct blob const *a, *b;
+    ssize_t shift;
+};
+
+bool diff_at(struct diff const *diff, size_t pos);
+ssize_t diff_next(struct diff const *diff, size_t pos, ssize_t dir);
+bool diff_align(struct diff const *diff, size_t pos, ssize_t *shift);
+
+#endif
@@ -0,0 +1,276 @@
+
+#define _GNU_SOURCE
+
+#include "dups.h"
+
+#include <assert.h>
+
+#include "trace.h"
+
+/* blocks are hashed among threads in jobs of about this many bytes */
+#define DUPS_CHUNK ((size_t) 4 << 20)
+
+#define K0 0x9e3779b97f4a7c15ull
+#define K1 0xbf58476d1ce4e5b9ull
+
+static uint64_t mix(uint64_t h)
+{
+    h ^= h >> 30;
+    h *= K1;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebull;
+    return h ^ h >> 31;
+}
+
+/*
+ * Not cryptographic: blocks with the same hash get compared anyway.  Four
+ * independent lanes keep the multiplier busy.  0 for a block of one
+ * repeated byte, which is checked on the way.
+ */
+static uint64_t hash_block(byte const *p, size_t n)
+{
+    uint64_t const fill = p[0] * 0x0101010101010101ull;
+    uint64_t h[4] = {n, K0, K1, ~n}, w, other = 0;
+    size_t j = 0;
+
+    for (; j + 32 <= n; j += 32)
+        for (unsigned l = 0; l < 4; ++l) {
+            memcpy(&w, p + j + 8 * l, 8);
+            other |= w ^ fill;
+            h[l] = (h[l] ^ w) * K0;
+            h[l] ^= h[l] >> 32;
+        }
+    for (; j + 8 <= n; j += 8) {
+        memcpy(&w, p + j, 8);
+        other |= w ^ fill;
+        h[0] = (h[0] ^ w) * K0;
+        h[0] ^= h[0] >> 32;
+    }
+    for (; j < n; ++j) {
+        other |= p[j] ^ p[0];
+        h[1] = (h[1] ^ p[j]) * K0;
+    }
+
+    if (!other)
+        return 0;
+    return mix(mix(mix(mix(h[0]) ^ h[1]) ^ h[2]) ^ h[3]) | 1;
+}
+
+struct dups_job {
+    struct blob const *blob;
+    size_t block, blocks, per_job;
+    uint64_t *hashes;
+};
+
+static bool hash_job(void *arg, size_t i)
+{
+    struct dups_job *J = arg;
+    size_t end = min((i + 1) * J->per_job, J->blocks);
+    byte *buf = NULL;
+
+    for (size_t b = i * J->per_job, n; b < end; ++b) {
+        byte const *p = blob_lookup(J->blob, b * J->block, &n);
+        /* crosses into another span or hole */
+        if (n < J->block) {
+            if (!buf)
+                buf = malloc_strict(J->block);
+            blob_read_strict(J->blob, b * J->block, buf, J->block);
+            p = buf;
+        }
+        J->hashes[b] = hash_block(p, J->block);
+    }
+
+    free(buf);
+    return true;
+}
+
+struct entry {
+    uint64_t hash;
+    size_t block;
+};
+
+static int cmp_entry(void const *a, void const *b)
+{
+    struct entry const *x = a, *y = b;
+    if (x->hash != y->hash)
+        return (x->hash > y->hash) - (x->hash < y->hash);
+    return (x->block > y->block) - (x->block < y->block);
+}
+
+struct found {
+    size_t first, off, n;
+};
+
+static int cmp_found(void const *a, void const *b)
+{
+    struct found const *x = a, *y = b;
+    return (x->first > y->first) - (x->first < y->first);
+}
+
+static void changed(void *arg, size_t pos, size_t old_len, size_t new_len)
+{
+    (void) pos, (void) old_len, (void) new_len;
+    ((struct dups *) arg)->stale = true;
+}
+
+void dups_init(struct dups *D)
+{
+    memset(D, 0, sizeof(*D));
+}
+
+void dups_free(struct dups *D)
+{
+    if (D->blob)
+        blob_unobserve(D->blob, &D->observer);
+    free(D->start);
+    free(D->members);
+    free(D->group);
+    dups_init(D);
+}
+
+/*
+ * Hashes every whole block, sorts the hashes, and compares the blocks
+ * within each run of equal hashes.  Calls progress (if given) while hashing.
+ */
+void dups_find(struct dups *D, struct blob *blob, size_t block,
+        void (*progress)(void *arg, size_t done, size_t total), void *arg)
+{
+    uint64_t tr = trace_begin();
+    struct dups_job J = {
+        .blob = blob, .block = block, .blocks = blob_length(blob) / block,
+        .per_job = max(DUPS_CHUNK / block, 1),
+    };
+    struct entry *E;
+    struct found *F;
+    size_t n = 0, nmembers = 0, ngroups = 0;
+    byte *a, *b;
+
+    assert(block >= DUPS_MIN_BLOCK && block <= DUPS_MAX_BLOCK);
+
+    dups_free(D);
+    D->blob = blob;
+    D->block = block;
+    D->blocks = J.blocks;
+    D->observer.changed = changed;
+    D->observer.arg = D;
+    blob_observe(blob, &D->observer);
+
+    J.hashes = malloc_strict(max(J.blocks, 1) * sizeof(*J.hashes));
+    parallel_blocks((J.blocks + J.per_job - 1) / J.per_job, hash_job, &J, progress, arg);
+
+    E = malloc_strict(max(J.blocks, 1) * sizeof(*E));
+    for (size_t i = 0; i < J.blocks; ++i)
+        if (J.hashes[i])
+            E[n++] = (struct entry) {J.hashes[i], i};
+    free(J.hashes);
+    qsort(E, n, sizeof(*E), cmp_entry);
+
+    D->members = malloc_strict(max(n, 1) * sizeof(*D->members));
+    F = malloc_strict(max(n / 2, 1) * sizeof(*F));
+    a = malloc_strict(block);
+    b = malloc_strict(block);
+
+    for (size_t i = 0, j; i < n; i = j) {
+        for (j = i + 1; j < n && E[j].hash == E[i].hash; ++j);
+        if (j - i < 2)
+            continue;
+
+        /* usually all the same; otherwise split the run by contents */
+        for (size_t r = i; r < j; ++r) {
+            size_t off = nmembers;
+            if (E[r].block == DUPS_NONE)
+                continue;
+            D->members[nmembers++] = E[r].block;
+            blob_read_strict(blob, E[r].block * block, a, block);
+            for (size_t s = r + 1; s < j; ++s) {
+                if (E[s].block == DUPS_NONE)
+                    continue;
+                blob_read_strict(blob, E[s].block * block, b, block);
+                if (!memcmp(a, b, block)) {
+                    D->members[nmembers++] = E[s].block;
+                    E[s].block = DUPS_NONE;
+                }
+            }
+            if (nmembers - off < 2)
+                nmembers = off;
+            else
+                F[ngroups++] = (struct found) {D->members[off], off, nmembers - off};
+        }
+    }
+
+    free(a);
+    free(b);
+    free(E);
+
+    /* in the order of their first block */
+    qsort(F, ngroups, sizeof(*F), cmp_found);
+    size_t *members = malloc_strict(max(nmembers, 1) * sizeof(*members));
+    D->start = malloc_strict((ngroups + 1) * sizeof(*D->start));
+    D->group = malloc_strict(max(J.blocks, 1) * sizeof(*D->group));
+    for (size_t i = 0; i < J.blocks; ++i)
+        D->group[i] = DUPS_NONE;
+    D->start[0] = 0;
+    for (size_t g = 0; g < ngroups; ++g) {
+        D->start[g + 1] = D->start[g] + F[g].n;
+        for (size_t k = 0; k < F[g].n; ++k) {
+            members[D->start[g] + k] = D->members[F[g].off + k];
+            D->group[D->members[F[g].off + k]] = g;
+        }
+    }
+    free(D->members);
+    D->members = members;
+    D->groups = ngroups;
+    free(F);
+
+    trace_end("dups", tr);
+}
+
+/* blocks in all groups */
+size_t dups_copies(struct dups const *D)
+{
+    return D->blob ? D->start[D->groups] : 0;
+}
+
+/* the group starting after (or before) pos, wrapping around */
+bool dups_next_group(struct dups const *D, size_t pos, ssize_t dir, size_t *to, size_t *g)
+{
+    size_t lo = 0, hi = D->groups;
+
+    if (!D->groups)
+        return false;
+
+    /* the first group starting after pos, or at least at pos */
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2, first = D->members[D->start[mid]] * D->block;
+        if (dir > 0 ? first <= pos : first < pos)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    *g = dir > 0 ? lo % D->groups : (lo + D->groups - 1) % D->groups;
+    *to = D->members[D->start[*g]] * D->block;
+    return true;
+}
+
+/* the next (or previous) copy of the block at pos, wrapping around; the k-th of n */
+bool dups_next_copy(struct dups const *D, size_t pos, ssize_t dir, size_t *to, size_t *k, size_t *n)
+{
+    size_t b = pos / D->block, g, lo, hi;
+
+    if (!D->blob || b >= D->blocks || (g = D->group[b]) == DUPS_NONE)
+        return false;
+
+    for (lo = D->start[g], hi = D->start[g + 1]; lo < hi; ) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (D->members[mid] < b)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    *n = D->start[g + 1] - D->start[g];
+    *k = (lo - D->start[g] + *n + (dir > 0 ? 1 : -1)) % *n;
+    *to = D->members[D->start[g] + *k] * D->block;
+    return true;
+}
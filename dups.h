@@ -0,0 +1,41 @@
+#ifndef DUPS_H
+#define DUPS_H
+
+#include "common.h"
+#include "blob.h"
+
+/*
+ * Groups of identical blocks at multiples of the block size.  Blocks of a
+ * single repeated byte (zeroed or erased space) are left out, and so is a
+ * partial block at the end.  The index describes the blob as it was when
+ * it was built; any change makes it stale.
+ */
+
+#define DUPS_MIN_BLOCK 16
+#define DUPS_MAX_BLOCK ((size_t) 16 << 20)
+
+#define DUPS_NONE ((size_t) -1)
+
+struct dups {
+    struct blob *blob;  /* NULL without an index */
+    struct blob_observer observer;
+    bool stale;
+
+    size_t block, blocks;
+    size_t groups;    /* ordered by their first block */
+    size_t *start;    /* group g is members[start[g]] to members[start[g + 1] - 1] */
+    size_t *members;  /* block numbers, ascending within each group */
+    size_t *group;    /* of each block, or DUPS_NONE */
+};
+
+void dups_init(struct dups *D);
+void dups_free(struct dups *D);
+
+void dups_find(struct dups *D, struct blob *blob, size_t block,
+        void (*progress)(void *arg, size_t done, size_t total), void *arg);
+
+size_t dups_copies(struct dups const *D);
+bool dups_next_group(struct dups const *D, size_t pos, ssize_t dir, size_t *to, size_t *g);
+bool dups_next_copy(struct dups const *D, size_t pos, ssize_t dir, size_t *to, size_t *k, size_t *n);
+
+#endif
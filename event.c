@@ -0,0 +1,87 @@
+
+#define _GNU_SOURCE
+
+#include "event.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+
+/*
+ * Self-pipe: signal handlers and other threads set bits in the mask and
+ * write a byte to the pipe, which wakes up a poll() in the main loop.
+ * Several events of the same kind in a row are coalesced into one.
+ */
+
+static unsigned events;
+static int pipefd[2] = {-1, -1};
+
+static void sighdlr(int num)
+{
+    int saved_errno = errno;
+
+    switch (num) {
+    case SIGWINCH:
+        event_post(EVENT_WINCH);
+        break;
+    case SIGTSTP:
+        event_post(EVENT_TSTP);
+        break;
+    case SIGCONT:
+        event_post(EVENT_CONT);
+        break;
+    }
+
+    errno = saved_errno;
+}
+
+void event_init(void)
+{
+    struct sigaction sigact;
+
+    if (pipe(pipefd))
+        pdie("pipe");
+    for (size_t i = 0; i < 2; ++i) {
+        if (fcntl(pipefd[i], F_SETFL, O_NONBLOCK) || fcntl(pipefd[i], F_SETFD, FD_CLOEXEC))
+            pdie("fcntl");
+    }
+
+    memset(&sigact, 0, sizeof(sigact));
+    sigact.sa_handler = sighdlr;
+    sigact.sa_flags = SA_RESTART;
+    sigaction(SIGWINCH, &sigact, NULL);
+    sigaction(SIGTSTP, &sigact, NULL);
+    sigaction(SIGCONT, &sigact, NULL);
+
+    sigact.sa_handler = SIG_IGN;
+    sigaction(SIGINT, &sigact, NULL);
+}
+
+/* async-signal-safe and thread-safe */
+void event_post(unsigned ev)
+{
+    byte b = 0;
+
+    __atomic_fetch_or(&events, ev, __ATOMIC_SEQ_CST);
+
+    /* if the pipe is full, a wakeup is pending anyway; nothing else fails here */
+    ssize_t r = write(pipefd[1], &b, 1);
+    (void) r;
+}
+
+/* never blocks */
+unsigned event_get(void)
+{
+    byte buf[0x40];
+
+    while (read(pipefd[0], buf, sizeof(buf)) > 0)
+        ;
+    return __atomic_exchange_n(&events, 0, __ATOMIC_SEQ_CST);
+}
+
+/* becomes readable when events are pending */
+int event_fd(void)
+{
+    return pipefd[0];
+}
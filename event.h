@@ -0,0 +1,21 @@
+#ifndef EVENT_H
+#define EVENT_H
+
+#include "common.h"
+
+/* things the main loop needs to react to, as a bit mask */
+enum event {
+    EVENT_WINCH = 1 << 0,  /* terminal resized */
+    EVENT_TSTP  = 1 << 1,  /* suspend requested */
+    EVENT_CONT  = 1 << 2,  /* resumed after suspend */
+    EVENT_JOB   = 1 << 3,  /* background job made progress */
+};
+
+void event_init(void);
+
+void event_post(unsigned events);
+unsigned event_get(void);
+
+int event_fd(void);
+
+#endif
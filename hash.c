@@ -0,0 +1,550 @@
+
+#define _GNU_SOURCE
+
+#include "hash.h"
+
+#include <assert.h>
+
+/* instructions beyond the build's target are used where the CPU has them */
+#if defined(__x86_64__) && defined(__GNUC__)
+#define HASH_X86
+#include <immintrin.h>
+#endif
+
+#include "blob.h"
+#include "trace.h"
+
+/* sequential hashes report progress after this much */
+#define HASH_CHUNK ((size_t) 1 << 20)
+
+/* CRCs of larger ranges are computed in blocks of this size among threads, then combined */
+#define HASH_BLOCK ((size_t) 4 << 20)
+
+/*
+ * CRCs, with bits reflected as usual: x^0 is the top bit.  The update
+ * functions work on the register, without the inversions at either end.
+ */
+
+struct crc {
+    enum hash_algo algo;
+    uint32_t poly;
+    bool ready;
+    uint32_t table[8][256];  /* [k][b]: b followed by k zero bytes */
+};
+
+static struct crc crc32 = {.algo = HASH_CRC32, .poly = 0xedb88320};
+static struct crc crc32c = {.algo = HASH_CRC32C, .poly = 0x82f63b78};
+
+#ifdef HASH_X86
+static struct {
+    pthread_once_t once;
+    bool clmul, crc32c, sha;
+} cpu = {.once = PTHREAD_ONCE_INIT};
+
+static void cpu_check(void)
+{
+    cpu.clmul = __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+    cpu.crc32c = __builtin_cpu_supports("sse4.2");
+    cpu.sha = __builtin_cpu_supports("sha") && __builtin_cpu_supports("sse4.1");
+}
+#endif
+
+/* picks the implementations, once; before any of them is used */
+static void cpu_init(void)
+{
+#ifdef HASH_X86
+    pthread_once(&cpu.once, cpu_check);
+#endif
+}
+
+static void crc_init(struct crc *C)
+{
+    cpu_init();
+    if (C->ready)
+        return;
+    for (unsigned b = 0; b < 256; ++b) {
+        uint32_t c = b;
+        for (unsigned j = 0; j < 8; ++j)
+            c = c & 1 ? c >> 1 ^ C->poly : c >> 1;
+        C->table[0][b] = c;
+    }
+    for (unsigned k = 1; k < 8; ++k)
+        for (unsigned b = 0; b < 256; ++b)
+            C->table[k][b] = C->table[k - 1][b] >> 8 ^ C->table[0][C->table[k - 1][b] & 0xff];
+    C->ready = true;
+}
+
+#ifdef HASH_X86
+/* folds 64 bytes at a time with carry-less multiplication; n >= 64, n % 16 == 0, crc32 only */
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t crc32_clmul(uint32_t c, byte const *p, size_t n)
+{
+    __m128i const k1k2 = _mm_set_epi64x(0x01c6e41596, 0x0154442bd4);
+    __m128i const k3k4 = _mm_set_epi64x(0x00ccaa009e, 0x01751997d0);
+    __m128i const k5k0 = _mm_set_epi64x(0, 0x0163cd6124);
+    __m128i const poly = _mm_set_epi64x(0x01f7011641, 0x01db710641);
+    __m128i const low = _mm_setr_epi32(~0, 0, ~0, 0);
+    __m128i x[4], y;
+
+    for (unsigned k = 0; k < 4; ++k)
+        x[k] = _mm_loadu_si128((__m128i const *) (p + 16 * k));
+    x[0] = _mm_xor_si128(x[0], _mm_cvtsi32_si128(c));
+    p += 64;
+    n -= 64;
+
+    for (; n >= 64; p += 64, n -= 64)
+        for (unsigned k = 0; k < 4; ++k) {
+            y = _mm_clmulepi64_si128(x[k], k1k2, 0x00);
+            x[k] = _mm_clmulepi64_si128(x[k], k1k2, 0x11);
+            x[k] = _mm_xor_si128(_mm_xor_si128(x[k], y),
+                    _mm_loadu_si128((__m128i const *) (p + 16 * k)));
+        }
+
+    /* down to 128 bits, then whatever 16-byte blocks are left */
+    for (unsigned k = 1; k < 4; ++k) {
+        y = _mm_clmulepi64_si128(x[0], k3k4, 0x00);
+        x[0] = _mm_clmulepi64_si128(x[0], k3k4, 0x11);
+        x[0] = _mm_xor_si128(_mm_xor_si128(x[0], x[k]), y);
+    }
+    for (; n >= 16; p += 16, n -= 16) {
+        y = _mm_clmulepi64_si128(x[0], k3k4, 0x00);
+        x[0] = _mm_clmulepi64_si128(x[0], k3k4, 0x11);
+        x[0] = _mm_xor_si128(_mm_xor_si128(x[0], _mm_loadu_si128((__m128i const *) p)), y);
+    }
+
+    /* to 64 bits */
+    y = _mm_clmulepi64_si128(x[0], k3k4, 0x10);
+    x[0] = _mm_xor_si128(_mm_srli_si128(x[0], 8), y);
+    y = _mm_srli_si128(x[0], 4);
+    x[0] = _mm_clmulepi64_si128(_mm_and_si128(x[0], low), k5k0, 0x00);
+    x[0] = _mm_xor_si128(x[0], y);
+
+    /* Barrett reduction to 32 bits */
+    y = _mm_clmulepi64_si128(_mm_and_si128(x[0], low), poly, 0x10);
+    y = _mm_clmulepi64_si128(_mm_and_si128(y, low), poly, 0x00);
+    return _mm_extract_epi32(_mm_xor_si128(x[0], y), 1);
+}
+
+/* n % 8 == 0, crc32c only */
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t c, byte const *p, size_t n)
+{
+    uint64_t w, d = c;
+    for (; n; p += 8, n -= 8) {
+        memcpy(&w, p, 8);
+        d = _mm_crc32_u64(d, w);
+    }
+    return d;
+}
+#endif
+
+static uint32_t crc_update(struct crc const *C, uint32_t c, byte const *p, size_t n)
+{
+    uint32_t const (*T)[256] = C->table;
+
+#ifdef HASH_X86
+    if (cpu.clmul && C->algo == HASH_CRC32 && n >= 64) {
+        size_t k = n & ~(size_t) 15;
+        c = crc32_clmul(c, p, k);
+        p += k;
+        n -= k;
+    }
+    if (cpu.crc32c && C->algo == HASH_CRC32C) {
+        size_t k = n & ~(size_t) 7;
+        c = crc32c_sse42(c, p, k);
+        p += k;
+        n -= k;
+    }
+#endif
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    /* slicing by 8 */
+    for (uint64_t w; n >= 8; p += 8, n -= 8) {
+        memcpy(&w, p, 8);
+        w ^= c;
+        c = T[7][w & 0xff] ^ T[6][w >> 8 & 0xff] ^ T[5][w >> 16 & 0xff] ^ T[4][w >> 24 & 0xff]
+          ^ T[3][w >> 32 & 0xff] ^ T[2][w >> 40 & 0xff] ^ T[1][w >> 48 & 0xff] ^ T[0][w >> 56];
+    }
+#endif
+    for (; n; --n)
+        c = T[0][(c ^ *p++) & 0xff] ^ c >> 8;
+    return c;
+}
+
+/* a * b modulo the polynomial */
+static uint32_t multmodp(uint32_t a, uint32_t b, uint32_t poly)
+{
+    uint32_t p = 0;
+    for (uint32_t m = (uint32_t) 1 << 31; m; m >>= 1) {
+        if (a & m)
+            p ^= b;
+        b = b & 1 ? b >> 1 ^ poly : b >> 1;
+    }
+    return p;
+}
+
+/* the CRC of a followed by b, from theirs */
+static uint32_t crc_combine(struct crc const *C, uint32_t a, uint32_t b, size_t b_len)
+{
+    uint32_t x = (uint32_t) 1 << 31, sq = (uint32_t) 1 << 23;  /* x^0, x^8 */
+
+    /* x^(8 b_len), to move a past b */
+    for (; b_len; b_len >>= 1) {
+        if (b_len & 1)
+            x = multmodp(x, sq, C->poly);
+        sq = multmodp(sq, sq, C->poly);
+    }
+    return multmodp(x, a, C->poly) ^ b;
+}
+
+struct crc_job {
+    struct blob const *blob;
+    struct crc const *crc;
+    size_t pos, len;
+    uint32_t *results;
+};
+
+static bool crc_block(void *arg, size_t i)
+{
+    struct crc_job *J = arg;
+    size_t from = J->pos + i * HASH_BLOCK, to = min(from + HASH_BLOCK, J->pos + J->len);
+    uint32_t c = ~(uint32_t) 0;
+
+    for (size_t n; from < to; from += n) {
+        byte const *p = blob_lookup(J->blob, from, &n);
+        n = min(n, to - from);
+        c = crc_update(J->crc, c, p, n);
+    }
+    J->results[i] = ~c;
+    return true;
+}
+
+static uint32_t crc_range(struct blob const *blob, size_t pos, size_t len, struct crc *C,
+        void (*progress)(void *, size_t, size_t), void *arg)
+{
+    struct crc_job J = {.blob = blob, .crc = C, .pos = pos, .len = len};
+    size_t blocks = (len + HASH_BLOCK - 1) / HASH_BLOCK;
+    uint32_t c = 0;
+
+    crc_init(C);
+    if (!len)
+        return 0;
+
+    J.results = malloc_strict(blocks * sizeof(*J.results));
+    parallel_blocks(blocks, crc_block, &J, progress, arg);
+
+    for (size_t i = 0; i < blocks; ++i)
+        c = i ? crc_combine(C, c, J.results[i], min(HASH_BLOCK, len - i * HASH_BLOCK)) : J.results[i];
+
+    free(J.results);
+    return c;
+}
+
+/*
+ * SHA-256
+ */
+
+static uint32_t const sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static inline uint32_t ror(uint32_t x, unsigned n)
+{
+    return x >> n | x << (32 - n);
+}
+
+static inline uint32_t load_be32(byte const *p)
+{
+    return (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 8 | p[3];
+}
+
+#ifdef HASH_X86
+__attribute__((target("sha,sse4.1")))
+static void sha256_blocks_sha(uint32_t *state, byte const *p, size_t blocks)
+{
+    __m128i const swap = _mm_set_epi64x(0x0c0d0e0f08090a0b, 0x0405060700010203);
+    __m128i s0, s1, t, m, w[16];
+
+    /* the instructions want the state as ABEF and CDGH */
+    t = _mm_shuffle_epi32(_mm_loadu_si128((__m128i const *) state), 0xb1);
+    s1 = _mm_shuffle_epi32(_mm_loadu_si128((__m128i const *) (state + 4)), 0x1b);
+    s0 = _mm_alignr_epi8(t, s1, 8);
+    s1 = _mm_blend_epi16(s1, t, 0xf0);
+
+    for (; blocks; --blocks, p += 64) {
+        __m128i a = s0, c = s1;
+        for (unsigned i = 0; i < 16; ++i) {
+            if (i < 4)
+                w[i] = _mm_shuffle_epi8(_mm_loadu_si128((__m128i const *) (p + 16 * i)), swap);
+            else {
+                t = _mm_add_epi32(_mm_sha256msg1_epu32(w[i - 4], w[i - 3]),
+                                  _mm_alignr_epi8(w[i - 1], w[i - 2], 4));
+                w[i] = _mm_sha256msg2_epu32(t, w[i - 1]);
+            }
+            m = _mm_add_epi32(w[i], _mm_loadu_si128((__m128i const *) (sha256_k + 4 * i)));
+            s1 = _mm_sha256rnds2_epu32(s1, s0, m);
+            s0 = _mm_sha256rnds2_epu32(s0, s1, _mm_shuffle_epi32(m, 0x0e));
+        }
+        s0 = _mm_add_epi32(s0, a);
+        s1 = _mm_add_epi32(s1, c);
+    }
+
+    t = _mm_shuffle_epi32(s0, 0x1b);
+    s1 = _mm_shuffle_epi32(s1, 0xb1);
+    _mm_storeu_si128((__m128i *) state, _mm_blend_epi16(t, s1, 0xf0));
+    _mm_storeu_si128((__m128i *) (state + 4), _mm_alignr_epi8(s1, t, 8));
+}
+#endif
+
+static void sha256_blocks_generic(uint32_t *state, byte const *p, size_t blocks)
+{
+    uint32_t w[64];
+
+    for (; blocks; --blocks, p += 64) {
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+
+        for (unsigned i = 0; i < 16; ++i)
+            w[i] = load_be32(p + 4 * i);
+        for (unsigned i = 16; i < 64; ++i)
+            w[i] = w[i - 16] + w[i - 7]
+                 + (ror(w[i - 15], 7) ^ ror(w[i - 15], 18) ^ w[i - 15] >> 3)
+                 + (ror(w[i - 2], 17) ^ ror(w[i - 2], 19) ^ w[i - 2] >> 10);
+
+        for (unsigned i = 0; i < 64; ++i) {
+            uint32_t t1 = h + (ror(e, 6) ^ ror(e, 11) ^ ror(e, 25)) + ((e & f) ^ (~e & g))
+                        + sha256_k[i] + w[i];
+            uint32_t t2 = (ror(a, 2) ^ ror(a, 13) ^ ror(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
+    }
+}
+
+static void sha256_blocks(uint32_t *state, byte const *p, size_t blocks)
+{
+#ifdef HASH_X86
+    if (cpu.sha) {
+        sha256_blocks_sha(state, p, blocks);
+        return;
+    }
+#endif
+    sha256_blocks_generic(state, p, blocks);
+}
+
+void sha256_init(struct sha256 *S)
+{
+    static uint32_t const iv[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+    cpu_init();
+    memcpy(S->state, iv, sizeof(iv));
+    S->len = 0;
+}
+
+void sha256_update(struct sha256 *S, byte const *data, size_t len)
+{
+    size_t fill = S->len % 64;
+
+    S->len += len;
+    if (fill) {
+        size_t n = min(64 - fill, len);
+        memcpy(S->buf + fill, data, n);
+        data += n;
+        len -= n;
+        if (fill + n < 64)
+            return;
+        sha256_blocks(S->state, S->buf, 1);
+    }
+    sha256_blocks(S->state, data, len / 64);
+    memcpy(S->buf, data + len / 64 * 64, len % 64);
+}
+
+void sha256_final(struct sha256 *S, byte *digest)
+{
+    byte pad[64 + 8] = {0x80};
+    size_t n = 64 - (S->len + 8) % 64;
+    uint64_t bits = S->len * 8;
+
+    for (unsigned j = 0; j < 8; ++j)
+        pad[n + j] = bits >> (56 - 8 * j);
+    sha256_update(S, pad, n + 8);
+    for (unsigned i = 0; i < 8; ++i)
+        for (unsigned j = 0; j < 4; ++j)
+            digest[4 * i + j] = S->state[i] >> (24 - 8 * j);
+}
+
+/*
+ * MD5
+ */
+
+struct md5 {
+    uint32_t state[4];
+    byte buf[64];
+    uint64_t len;
+};
+
+static uint32_t const md5_k[64] = {
+    0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+    0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+    0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+    0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+    0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+    0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+    0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+    0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391,
+};
+
+static unsigned const md5_r[4][4] = {{7, 12, 17, 22}, {5, 9, 14, 20}, {4, 11, 16, 23}, {6, 10, 15, 21}};
+
+static void md5_blocks(uint32_t *state, byte const *p, size_t blocks)
+{
+    uint32_t w[16];
+
+    for (; blocks; --blocks, p += 64) {
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3], f, t;
+        unsigned g;
+
+        for (unsigned i = 0; i < 16; ++i)
+            w[i] = (uint32_t) p[4 * i] | (uint32_t) p[4 * i + 1] << 8
+                 | (uint32_t) p[4 * i + 2] << 16 | (uint32_t) p[4 * i + 3] << 24;
+
+        for (unsigned i = 0; i < 64; ++i) {
+            switch (i / 16) {
+            case 0: f = (b & c) | (~b & d); g = i; break;
+            case 1: f = (d & b) | (~d & c); g = 5 * i + 1; break;
+            case 2: f = b ^ c ^ d; g = 3 * i + 5; break;
+            default: f = c ^ (b | ~d); g = 7 * i; break;
+            }
+            t = a + f + md5_k[i] + w[g % 16];
+            a = d;
+            d = c;
+            c = b;
+            b += ror(t, 32 - md5_r[i / 16][i % 4]);
+        }
+
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+    }
+}
+
+static void md5_init(struct md5 *M)
+{
+    static uint32_t const iv[4] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476};
+    memcpy(M->state, iv, sizeof(iv));
+    M->len = 0;
+}
+
+static void md5_update(struct md5 *M, byte const *data, size_t len)
+{
+    size_t fill = M->len % 64;
+
+    M->len += len;
+    if (fill) {
+        size_t n = min(64 - fill, len);
+        memcpy(M->buf + fill, data, n);
+        data += n;
+        len -= n;
+        if (fill + n < 64)
+            return;
+        md5_blocks(M->state, M->buf, 1);
+    }
+    md5_blocks(M->state, data, len / 64);
+    memcpy(M->buf, data + len / 64 * 64, len % 64);
+}
+
+static void md5_final(struct md5 *M, byte *digest)
+{
+    byte pad[64 + 8] = {0x80};
+    size_t n = 64 - (M->len + 8) % 64;
+    uint64_t bits = M->len * 8;
+
+    for (unsigned j = 0; j < 8; ++j)
+        pad[n + j] = bits >> 8 * j;
+    md5_update(M, pad, n + 8);
+    for (unsigned i = 0; i < 4; ++i)
+        for (unsigned j = 0; j < 4; ++j)
+            digest[4 * i + j] = M->state[i] >> 8 * j;
+}
+
+/*
+ * The digest of [pos, pos + len) and its length; CRCs come out big-endian.
+ * Calls progress (if given) from time to time.
+ */
+size_t hash_range(struct blob const *blob, size_t pos, size_t len, enum hash_algo algo, byte *digest,
+        void (*progress)(void *arg, size_t done, size_t total), void *arg)
+{
+    uint64_t tr = trace_begin();
+    struct sha256 S;
+    struct md5 M;
+    uint32_t c;
+    size_t ret;
+
+    assert(pos + len <= blob_length(blob));
+
+    switch (algo) {
+    case HASH_CRC32:
+    case HASH_CRC32C:
+        c = crc_range(blob, pos, len, algo == HASH_CRC32 ? &crc32 : &crc32c, progress, arg);
+        for (unsigned j = 0; j < 4; ++j)
+            digest[j] = c >> (24 - 8 * j);
+        ret = 4;
+        break;
+
+    case HASH_MD5:
+    case HASH_SHA256:
+        if (algo == HASH_MD5)
+            md5_init(&M);
+        else
+            sha256_init(&S);
+        for (size_t i = 0, n, e; i < len; i = e) {
+            e = min(len, i + HASH_CHUNK);
+            for (; i < e; i += n) {
+                byte const *p = blob_lookup(blob, pos + i, &n);
+                n = min(n, e - i);
+                if (algo == HASH_MD5)
+                    md5_update(&M, p, n);
+                else
+                    sha256_update(&S, p, n);
+            }
+            if (progress)
+                progress(arg, e, len);
+        }
+        if (algo == HASH_MD5)
+            md5_final(&M, digest);
+        else
+            sha256_final(&S, digest);
+        ret = algo == HASH_MD5 ? 16 : SHA256_LEN;
+        break;
+
+    default:
+        die("unknown hash");
+    }
+
+    trace_end("hash", tr);
+    return ret;
+}
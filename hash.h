@@ -0,0 +1,31 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include "common.h"
+
+struct blob;
+
+enum hash_algo {
+    HASH_CRC32,
+    HASH_CRC32C,
+    HASH_MD5,
+    HASH_SHA256,
+};
+
+#define HASH_MAX_LEN 32
+#define SHA256_LEN 32
+
+struct sha256 {
+    uint32_t state[8];
+    byte buf[64];
+    uint64_t len;
+};
+
+void sha256_init(struct sha256 *S);
+void sha256_update(struct sha256 *S, byte const *data, size_t len);
+void sha256_final(struct sha256 *S, byte *digest);
+
+size_t hash_range(struct blob const *blob, size_t pos, size_t len, enum hash_algo algo, byte *digest,
+        void (*progress)(void *arg, size_t done, size_t total), void *arg);
+
+#endif
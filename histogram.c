@@ -0,0 +1,109 @@
+
+#define _GNU_SOURCE
+
+#include "histogram.h"
+
+#include <assert.h>
+#include <math.h>
+
+#include "blob.h"
+#include "trace.h"
+
+/* counted among threads in blocks of this size, which 32-bit counters can hold */
+#define HIST_BLOCK ((size_t) 4 << 20)
+
+struct hist_job {
+    struct blob const *blob;
+    size_t pos, len;
+
+    pthread_mutex_t lock;  /* for merging into result */
+    struct histogram *result;
+};
+
+static void count_span(byte const *p, size_t n, uint32_t part[4][256])
+{
+    size_t j = 0;
+    for (; j + 4 <= n; j += 4) {
+        ++part[0][p[j]];
+        ++part[1][p[j + 1]];
+        ++part[2][p[j + 2]];
+        ++part[3][p[j + 3]];
+    }
+    for (; j < n; ++j)
+        ++part[0][p[j]];
+}
+
+/* adds the byte frequencies of [from, to) to count */
+void histogram_count(struct blob const *blob, size_t from, size_t to, uint64_t count[256])
+{
+    while (from < to) {
+        /* fewer stalls on repeated bytes */
+        uint32_t part[4][256] = {{0}};
+        size_t end = min(from + HIST_BLOCK, to);
+
+        for (size_t n, h_from, h_to; from < end; from += n) {
+            /* don't fault in the holes only to count zeros */
+            if (blob_hole(blob, from, &h_from, &h_to)) {
+                n = min(h_to, end) - from;
+                count[0] += n;
+                continue;
+            }
+            byte const *p = blob_lookup(blob, from, &n);
+            n = min(n, end - from);
+            count_span(p, n, part);
+        }
+        for (unsigned b = 0; b < 256; ++b)
+            count[b] += (uint64_t) part[0][b] + part[1][b] + part[2][b] + part[3][b];
+    }
+}
+
+static bool hist_block(void *arg, size_t i)
+{
+    struct hist_job *J = arg;
+    size_t from = J->pos + i * HIST_BLOCK, to = min(from + HIST_BLOCK, J->pos + J->len);
+    uint64_t sum[256] = {0};
+
+    histogram_count(J->blob, from, to, sum);
+
+    pthread_mutex_lock(&J->lock);
+    for (unsigned b = 0; b < 256; ++b)
+        J->result->count[b] += sum[b];
+    pthread_mutex_unlock(&J->lock);
+    return true;
+}
+
+/* byte frequencies of [pos, pos + len); calls progress (if given) from time to time */
+void histogram_range(struct blob const *blob, size_t pos, size_t len, struct histogram *H,
+        void (*progress)(void *arg, size_t done, size_t total), void *arg)
+{
+    uint64_t tr = trace_begin();
+    struct hist_job J = {.blob = blob, .pos = pos, .len = len, .result = H};
+
+    assert(pos + len <= blob_length(blob));
+
+    memset(H, 0, sizeof(*H));
+    H->bytes = len;
+    if (pthread_mutex_init(&J.lock, NULL))
+        die("pthread_mutex_init");
+
+    parallel_blocks((len + HIST_BLOCK - 1) / HIST_BLOCK, hist_block, &J, progress, arg);
+
+    pthread_mutex_destroy(&J.lock);
+    trace_end("histogram", tr);
+}
+
+/* Shannon entropy of bytes bytes with these frequencies, in bits for all of them */
+double histogram_bits(uint64_t const count[256], uint64_t bytes)
+{
+    double e = 0;
+    for (unsigned b = 0; b < 256; ++b)
+        if (count[b])
+            e -= count[b] * log2((double) count[b] / bytes);
+    return e;
+}
+
+/* in bits per byte */
+double histogram_entropy(struct histogram const *H)
+{
+    return H->bytes ? histogram_bits(H->count, H->bytes) / H->bytes : 0;
+}
@@ -0,0 +1,20 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include "common.h"
+
+struct blob;
+
+struct histogram {
+    uint64_t count[256];
+    uint64_t bytes;
+};
+
+void histogram_range(struct blob const *blob, size_t pos, size_t len, struct histogram *H,
+        void (*progress)(void *arg, size_t done, size_t total), void *arg);
+
+void histogram_count(struct blob const *blob, size_t from, size_t to, uint64_t count[256]);
+double histogram_bits(uint64_t const count[256], uint64_t bytes);
+double histogram_entropy(struct histogram const *H);
+
+#endif
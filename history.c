@@ -1,17 +1,25 @@
 
+#define _GNU_SOURCE
+
 #include "history.h"
 
 #include "common.h"
 #include "blob.h"
+#include "trace.h"
 
 struct change {
     enum change_type type;
     size_t pos;
     byte *data;
     size_t len;
+    size_t period;  /* FILL: bytes of data, repeated over len */
     struct change *next;
 };
 
+/* long enough replaced ranges that repeat a pattern this short are kept as FILL */
+#define FILL_MIN_LEN 0x1000
+#define FILL_MAX_PERIOD 16
+
 static void change_apply(struct blob *blob, struct change *change)
 {
     switch (change->type) {
@@ -24,6 +32,9 @@ static void change_apply(struct blob *blob, struct change *change)
     case DELETE:
         blob_delete(blob, change->pos, change->len, false);
         break;
+    case FILL:
+        blob_fill(blob, change->pos, change->len, change->data, change->period, false);
+        break;
     default:
         die("unknown operation");
     }
@@ -46,6 +57,35 @@ void history_free(struct change **history)
     *history = NULL;
 }
 
+/* the period if [pos, pos + len) is worth keeping as a FILL, with the pattern in *pattern */
+static size_t period(struct blob const *blob, size_t pos, size_t len, byte **pattern)
+{
+    byte head[2 * FILL_MAX_PERIOD], block[0x1000 + FILL_MAX_PERIOD];
+    size_t p;
+
+    if (len < FILL_MIN_LEN)
+        return 0;
+
+    blob_read_strict(blob, pos, head, sizeof(head));
+    for (p = 1; p <= FILL_MAX_PERIOD; ++p)
+        if (!memcmp(head, head + p, sizeof(head) - p))
+            break;
+    if (p > FILL_MAX_PERIOD)
+        return 0;
+
+    for (size_t j = 0; j < sizeof(block); ++j)
+        block[j] = head[j % p];
+    for (size_t i = 0, n; i < len; i += n) {
+        byte const *q = blob_lookup(blob, pos + i, &n);
+        n = min(min(n, len - i), 0x1000);
+        if (memcmp(q, block + i % p, n))
+            return 0;
+    }
+
+    memcpy(*pattern = malloc_strict(p), head, p);
+    return p;
+}
+
 /* pushes a change that _undoes_ the passed operation */
 void history_save(struct change **history, enum change_type type, struct blob *blob, size_t pos, size_t len)
 {
@@ -53,13 +93,22 @@ void history_save(struct change **history, enum change_type type, struct blob *b
     change->type = type;
     change->pos = pos;
     change->len = len;
+    change->period = 0;
     change->next = *history;
 
     switch (type) {
+    case REPLACE:
+    case FILL:
+        /* either way, undone by putting back what was there */
+        if ((change->period = period(blob, pos, len, &change->data)))
+            change->type = FILL;
+        else {
+            change->type = REPLACE;
+            blob_read_strict(blob, pos, change->data = malloc_strict(len), len);
+        }
+        break;
     case DELETE:
         change->type = INSERT;
-        /* fall-through */
-    case REPLACE:
         blob_read_strict(blob, pos, change->data = malloc_strict(len), len);
         break;
     case INSERT:
@@ -80,6 +129,8 @@ bool history_step(struct change **from, struct blob *blob, struct change **to, s
     if (!change)
         return false;
 
+    uint64_t tr = trace_begin();
+
     if (pos)
         *pos = change->pos;
 
@@ -91,6 +142,154 @@ bool history_step(struct change **from, struct blob *blob, struct change **to, s
     free(change->data);
     free(change);
 
+    trace_end("history_step", tr);
     return true;
 }
 
+/*
+ * Sorted, with gaps in between; an edit touching a neighbor merges with
+ * it.  Extents that only hold inserted bytes can vanish again.
+ */
+struct extent {
+    size_t from, to;
+    bool lost;  /* original bytes were overwritten or removed */
+};
+
+struct extents {
+    struct extent *list;
+    size_t count;
+};
+
+static void extents_mark(struct extents *E, size_t from, size_t to, bool lost)
+{
+    size_t i = 0, j;
+
+    while (i < E->count && E->list[i].to < from)
+        ++i;
+    for (j = i; j < E->count && E->list[j].from <= to; ++j) {
+        from = min(from, E->list[j].from);
+        to = max(to, E->list[j].to);
+        lost |= E->list[j].lost;
+    }
+
+    if (i == j) {
+        E->list = realloc_strict(E->list, ++E->count * sizeof(*E->list));
+        memmove(E->list + i + 1, E->list + i, (E->count - i - 1) * sizeof(*E->list));
+    }
+    else {
+        memmove(E->list + i + 1, E->list + j, (E->count - j) * sizeof(*E->list));
+        E->count -= j - i - 1;
+    }
+    E->list[i] = (struct extent) {from, to, lost};
+}
+
+/* the extent containing all of [from, to), if any */
+static struct extent *extents_find(struct extents *E, size_t from, size_t to)
+{
+    for (size_t i = 0; i < E->count && E->list[i].from <= from; ++i)
+        if (to <= E->list[i].to)
+            return &E->list[i];
+    return NULL;
+}
+
+static void extents_replace(struct extents *E, size_t pos, size_t len)
+{
+    /* inserted bytes stay inserted ones */
+    if (!extents_find(E, pos, pos + len))
+        extents_mark(E, pos, pos + len, true);
+}
+
+/* len bytes were inserted at pos */
+static void extents_open(struct extents *E, size_t pos, size_t len)
+{
+    for (struct extent *e = E->list; e < E->list + E->count; ++e) {
+        if (e->to > pos || e->from >= pos)
+            e->to += len;
+        if (e->from >= pos)
+            e->from += len;
+    }
+    extents_mark(E, pos, pos + len, false);
+}
+
+static size_t cut(size_t x, size_t pos, size_t len)
+{
+    return x <= pos ? x : x >= pos + len ? x - len : pos;
+}
+
+/* len bytes at pos were deleted */
+static void extents_cut(struct extents *E, size_t pos, size_t len)
+{
+    struct extent *e = extents_find(E, pos, pos + len);
+    bool inserted = e && !e->lost;
+
+    for (e = E->list; e < E->list + E->count; ++e) {
+        e->from = cut(e->from, pos, len);
+        e->to = cut(e->to, pos, len);
+    }
+
+    if (!inserted)
+        extents_mark(E, pos, pos, true);
+    else if ((e = extents_find(E, pos, pos)) && e->from == e->to) {
+        /* nothing is left of what was inserted */
+        memmove(e, e + 1, (E->list + --E->count - e) * sizeof(*e));
+    }
+}
+
+/*
+ * What differs from the state the first steps changes of the history lead
+ * back to, in current positions: replays the edits they undo, oldest first.
+ * Fails if the history is shorter than that.
+ */
+bool history_extents(struct change const *history, size_t steps, struct blob_extent **list, size_t *count)
+{
+    struct change const **path = malloc_strict(max(steps, 1) * sizeof(*path));
+    struct extents E = {NULL, 0};
+    size_t n = 0, i;
+
+    for (; history && n < steps; history = history->next)
+        path[n++] = history;
+    if (n < steps) {
+        free(path);
+        return false;
+    }
+
+    while (n--) {
+        struct change const *c = path[n];
+        switch (c->type) {
+        case REPLACE:
+        case FILL:
+            extents_replace(&E, c->pos, c->len);
+            break;
+        case INSERT: /* undoes a deletion */
+            extents_cut(&E, c->pos, c->len);
+            break;
+        case DELETE: /* undoes an insertion */
+            extents_open(&E, c->pos, c->len);
+            break;
+        default:
+            die("unknown operation");
+        }
+    }
+
+    free(path);
+    *list = malloc_strict(max(E.count, 1) * sizeof(**list));
+    for (i = 0; i < E.count; ++i) {
+        (*list)[i].from = E.list[i].from;
+        (*list)[i].to = E.list[i].to;
+    }
+    *count = E.count;
+    free(E.list);
+    return true;
+}
+
+/* number of entries and memory used */
+void history_stats(struct change const *history, size_t *count, size_t *bytes)
+{
+    *count = *bytes = 0;
+    for (; history; history = history->next) {
+        ++*count;
+        if (history->data)
+            *bytes += history->type == FILL ? history->period : history->len;
+        *bytes += sizeof(*history);
+    }
+}
@@ -6,10 +6,15 @@
 struct blob;
 
 struct change;
+struct blob_extent;
 
 void history_init(struct change **history);
 void history_free(struct change **history);
 void history_save(struct change **history, enum change_type type, struct blob *blob, size_t pos, size_t len);
 bool history_step(struct change **history, struct blob *blob, struct change **target, size_t *pos);
 
+bool history_extents(struct change const *history, size_t steps, struct blob_extent **list, size_t *count);
+
+void history_stats(struct change const *history, size_t *count, size_t *bytes);
+
 #endif
@@ -24,44 +24,26 @@
 #include "term.h"
 #include "view.h"
 #include "input.h"
+#include "pane.h"
+#include "screen.h"
+#include "event.h"
+#include "replay.h"
+#include "stats.h"
+#include "trace.h"
+#include "minimap.h"
+#include "merkle.h"
 
 #include <unistd.h>
 #include <signal.h>
-#include <setjmp.h>
 
 
 struct blob blob;
-struct view view;
-struct input input;
-
-bool quit;
-
-jmp_buf jmp_mainloop;
 
+/* diff mode: the file compared against, shown next to the other one */
+struct blob other_blob;
+struct view other_view;
 
-static void sighdlr(int num)
-{
-    switch (num) {
-    case SIGWINCH:
-        term.winch = true;
-        break;
-    case SIGTSTP:
-        term.tstp = true;
-        break;
-    case SIGCONT:
-        term.cont = true;
-        break;
-    case SIGALRM:
-        /* This is used in parsing escape sequences,
-         * but we don't need to do anything here. */
-        break;
-    case SIGINT:
-        /* ignore */
-        break;
-    default:
-        die("unrecognized signal");
-    }
-}
+bool quit;
 
 __attribute__((noreturn)) void version(void)
 {
@@ -81,12 +63,18 @@ __attribute__((noreturn)) void help(int st)
     printf("    %sinvocation:%s hyx [filename]\n",
             tty ? color_yellow : "", tty ? color_normal : "");
 
-    printf("    %sinvocation:%s [command] | hyx\n\n",
+    printf("    %sinvocation:%s [command] | hyx\n",
+            tty ? color_yellow : "", tty ? color_normal : "");
+
+    printf("    %sinvocation:%s hyx --record|--replay (keys) [filename]\n",
+            tty ? color_yellow : "", tty ? color_normal : "");
+
+    printf("    %sinvocation:%s hyx -d (filename) (other filename)\n\n",
             tty ? color_yellow : "", tty ? color_normal : "");
 
     printf("    %skeys:%s\n\n",
             tty ? color_yellow : "", tty ? color_normal : "");
-    printf("q               quit\n");
+    printf("q               quit, or close the pane if there are more\n");
     printf("\n");
     printf("h, j, k, l      move cursor\n");
     printf("(hex digits)    edit bytes (in hex mode)\n");
@@ -110,16 +98,33 @@ __attribute__((noreturn)) void help(int st)
     printf("ctrl+u, ctrl+d  scroll up/down one page\n");
     printf("g, G            jump to start/end of screen or file\n");
     printf("^, $            jump to start/end of current line\n");
+    printf("{, }            jump to previous/next boundary between data\n");
+    printf("                and runs of 00 or ff bytes\n");
+    printf("(, )            jump to previous/next change since the last save\n");
     printf("\n");
     printf(":               enter command (see below)\n");
     printf("\n");
     printf("/x (hex string) search for hexadecimal bytes\n");
     printf("/s (characters) search for unicode string (utf8)\n");
     printf("/w (characters) search for unicode string (ucs2)\n");
+    printf("/si, /wi        same as /s, /w, but ignoring ascii case\n");
+    printf("/~ (k) (hex)    search for hex bytes with at most k bytes differing\n");
+    printf("/~b (k) (hex)   same as /~, but counting differing bits\n");
+    printf("/u32 (integer)  search for integer; also i8..i64, suffix le/be\n");
+    printf("/f32 (float)    search for float; also f64, optional tolerance\n");
     printf("n, N            jump to next/previous match\n");
     printf("\n");
+    printf("]c, [c          jump to next/previous difference (with -d)\n");
+    printf("ctrl+n, ctrl+p  jump to next/previous group of identical\n");
+    printf("                blocks (after :dups)\n");
+    printf("*, #            jump to next/previous copy of the current block\n");
+    printf("\n");
     printf("ctrl+a, ctrl+x  increment/decrement current byte\n");
     printf("\n");
+    printf("ctrl+w s, v     split pane above/below or side by side\n");
+    printf("ctrl+w w, W     focus next/previous pane\n");
+    printf("ctrl+w q        close pane\n");
+    printf("\n");
     printf("ctrl+g          show file name and current position\n");
     printf("ctrl+z          suspend editor; use \"fg\" to continue\n");
     printf("\n");
@@ -127,10 +132,38 @@ __attribute__((noreturn)) void help(int st)
     printf("    %scommands:%s\n\n",
             tty ? color_yellow : "", tty ? color_normal : "");
     printf("(offset)        jump to offset (supports hex/dec/oct)\n");
-    printf("q               quit\n");
+    printf("q               quit, or close the pane if there are more\n");
     printf("w [filename]    save\n");
     printf("wq [filename]   save and quit\n");
     printf("colors y/n      toggle colors\n");
+    printf("map [y/n]       toggle sidebar with entropy of blocks;\n");
+    printf("                click on it to jump there\n");
+    printf("map +, map -    zoom sidebar in/out around the cursor\n");
+    printf("align [offset]  shift the other file (with -d) by offset,\n");
+    printf("                or to where the files match again\n");
+    printf("split, vsplit   split pane above/below or side by side\n");
+    printf("close           close pane\n");
+    printf("changes         list what changed since the last save\n");
+    printf("fill (hex)      fill the selection with the repeated pattern\n");
+    printf("xor (hex), add (hex)\n");
+    printf("                xor or add the repeated key to the selection\n");
+    printf("rol (bits)      rotate the bits of each selected byte\n");
+    printf("bswap16, bswap32, bswap64\n");
+    printf("                swap the bytes of each selected word\n");
+    printf("crc32, crc32c, md5, sha256 [w]\n");
+    printf("                hash the selection or the whole file;\n");
+    printf("                \"w\" writes the digest at the cursor,\n");
+    printf("                \"wle\" a crc little-endian\n");
+    printf("merkle          tree hash of the file (or of the selection),\n");
+    printf("                kept up to date in the background\n");
+    printf("                after the first use\n");
+    printf("same            whether the selection or the whole file\n");
+    printf("                is the same as saved, and if not, where not\n");
+    printf("hist            byte histogram, entropy and more of the\n");
+    printf("                selection or the whole file\n");
+    printf("dups [size]     find identical blocks of the given size,\n");
+    printf("                4096 by default\n");
+    printf("stats           show timings and memory use\n");
 #if 0
     printf("columns [num]   set number of displayed columns; \"auto\" for default\n");
     printf("digits [num]    set width of position indicator; \"auto\" for default\n");
@@ -138,14 +171,20 @@ __attribute__((noreturn)) void help(int st)
 
     printf("\n");
 
+    printf("    %senvironment:%s\n\n",
+            tty ? color_yellow : "", tty ? color_normal : "");
+    printf("HYX_STATS       file to write the output of :stats to on exit\n");
+    printf("HYX_TRACE       file to write a chrome://tracing profile to\n");
+    printf("\n");
+
     exit(st);
 }
 
 int main(int argc, char **argv)
 {
-    struct sigaction sigact;
-
-    char *filename = NULL;
+    char *filename = NULL, *other = NULL;
+    char *record = NULL, *replay_file = NULL;
+    bool diff = false;
 
     bool parse_args = true;
     for (size_t i = 1; i < (size_t) argc; ++i) {
@@ -155,14 +194,28 @@ int main(int argc, char **argv)
             help(0);
         else if (parse_args && (!strcmp(argv[i], "-v") || !strcmp(argv[i], "--version")))
             version();
+        else if (parse_args && !strcmp(argv[i], "--record") && i + 1 < (size_t) argc)
+            record = argv[++i];
+        else if (parse_args && !strcmp(argv[i], "--replay") && i + 1 < (size_t) argc)
+            replay_file = argv[++i];
+        else if (parse_args && !strcmp(argv[i], "-d"))
+            diff = true;
         else if (parse_args && *argv[i] == '-')
             help(EXIT_FAILURE); /* unrecognized command-line argument */
         else if (!filename)
             filename = argv[i];
+        else if (diff && !other)
+            other = argv[i];
         else
             help(EXIT_FAILURE);
     }
 
+    if (diff && !other)
+        help(EXIT_FAILURE);
+
+    if (getenv("HYX_TRACE"))
+        trace_init(getenv("HYX_TRACE"));
+
     blob_init(&blob);
     if (!isatty(fileno(stdin))) {
         if (filename)
@@ -175,55 +228,111 @@ int main(int argc, char **argv)
         blob_load(&blob, filename);
     }
 
+    if (diff) {
+        blob_init(&other_blob);
+        blob_load(&other_blob, other);
+    }
+
+    if (record && replay_file)
+        help(EXIT_FAILURE);
+    if (record)
+        record_open(record);
+    if (replay_file)
+        replay_open(replay_file);
+
     term_init();
-    view_init(&view, &blob, &input);
-    input_init(&input, &view);
-
-    /* set up signal handler */
-    memset(&sigact, 0, sizeof(sigact));
-    sigact.sa_handler = sighdlr;
-    sigaction(SIGWINCH, &sigact, NULL);
-    sigaction(SIGTSTP, &sigact, NULL);
-    sigaction(SIGCONT, &sigact, NULL);
-    sigaction(SIGALRM, &sigact, NULL);
-    sigaction(SIGINT, &sigact, NULL);
+    screen_init();
+    struct pane *P = pane_open(&blob);
+
+    if (diff) {
+        /* follows the cursor, which belongs to the first file */
+        view_init(&other_view, &other_blob, &P->input);
+        P->view.peer = &other_view;
+        other_view.peer = &P->view;
+    }
+
+    event_init();
 
     term_visual();
-    term.winch = true;
+
+    unsigned events = EVENT_WINCH;
+    uint64_t last_frame = 0;
 
     do {
-        /* This is used to redraw immediately when the window size changes. */
-        setjmp(jmp_mainloop);
+        events |= event_get();
 
-        if (term.winch) {
-            term_size(&view.width, &view.height);
-            view_recompute(&view, true);
-            term.winch = false;
-        }
-        if (term.tstp) {
+        if (events & EVENT_TSTP) {
             term_text(true);
-            term.tstp = false;
             raise(SIGSTOP);
-            /* should continue with term.cont == true */
+            /* should continue with EVENT_CONT */
+            events |= event_get();
         }
-        if (term.cont) {
+        if (events & EVENT_CONT) {
             term_visual();
-            view_dirty_from(&view, 0);
-            term.winch = true;
-            term.cont = false;
-            continue;
+            events |= EVENT_WINCH;
+        }
+        if (events & EVENT_WINCH) {
+            /* any number of resizes since the last frame: redraw once */
+            unsigned width, height;
+            term_size(&width, &height);
+            screen_resize(width, height);
+            pane_layout(width, height);
+        }
+        events = 0;
+
+        P = pane_focus();
+        assert(P->input.cur >= P->view.start && P->input.cur < P->view.start + P->view.rows * P->view.cols);
+
+        /* Keys that are already queued up are handled before drawing,
+         * so that the screen doesn't lag behind when keys repeat. */
+        if (!input_pending() || P->input.mode == COMMAND || P->input.mode == SEARCH
+                || monotonic_microtime() - last_frame >= CONFIG_FRAME_INTERVAL) {
+            uint64_t t = monotonic_microtime();
+            pane_update();
+            last_frame = monotonic_microtime();
+            stats_record(STAT_RENDER, last_frame - t);
+            if (replay_active())
+                replay_frame(last_frame - t, screen.flush_time);
         }
-        assert(input.cur >= view.start && input.cur < view.start + view.rows * view.cols);
-        view_update(&view);
 
-        input_get(&input, &quit);
+        uint64_t t = monotonic_microtime();
+        stats.wait = 0;
+        input_get(&P->input, &quit);
+        pane_reap();
+        if (!replay.done) {
+            t = monotonic_microtime() - t - stats.wait;
+            stats_record(STAT_KEY, t);
+            if (replay_active())
+                replay_key(t);
+        }
 
-    } while (!quit);
+    } while (!quit && !replay.done);
 
     term_text(true);
 
-    input_free(&input);
-    view_free(&view);
+    if (replay_active()) {
+        replay_summary(stderr);
+        replay_close();
+    }
+
+    if (getenv("HYX_STATS")) {
+        FILE *fp = fopen(getenv("HYX_STATS"), "w");
+        if (!fp)
+            pdie("could not open stats file");
+        stats_print(fp, &blob);
+        fclose(fp);
+    }
+
+    minimap_stop();
+    merkle_stop();
+
+    if (diff)
+        view_free(&other_view);
+    pane_free();
+    screen_free();
     blob_free(&blob);
+
+    if (diff)
+        blob_free(&other_blob);
 }
 
@@ -5,26 +5,39 @@
 
 #include <ctype.h>
 #include <errno.h>
-#include <sys/time.h>
+#include <math.h>
+#include <poll.h>
+#include <unistd.h>
 
 #include "ansi.h"
 #include "common.h"
 #include "blob.h"
+#include "diff.h"
 #include "history.h"
 #include "term.h"
 #include "view.h"
-
-extern jmp_buf jmp_mainloop; /* hyx.c */
+#include "pane.h"
+#include "screen.h"
+#include "event.h"
+#include "replay.h"
+#include "stats.h"
+#include "transform.h"
+#include "hash.h"
+#include "merkle.h"
+#include "histogram.h"
 
 void input_init(struct input *input, struct view *view)
 {
     memset(input, 0, sizeof(*input));
     input->view = view;
+    search_init(&input->search);
+    dups_init(&input->dups);
 }
 
 void input_free(struct input *input)
 {
-    free(input->search.needle);
+    search_free(&input->search);
+    dups_free(&input->dups);
 }
 
 /*
@@ -40,138 +53,208 @@ enum {
     KEY_SPECIAL_UP, KEY_SPECIAL_DOWN, KEY_SPECIAL_RIGHT, KEY_SPECIAL_LEFT,
     KEY_SPECIAL_PGUP, KEY_SPECIAL_PGDOWN,
     KEY_SPECIAL_HOME, KEY_SPECIAL_END,
+    KEY_MOUSE,
 };
 
-static key getch(void)
+/* where the last mouse click was, starting at 0 */
+static struct {
+    unsigned x, y;
+} mouse;
+
+/* everything the terminal sent that we haven't processed yet */
+static struct {
+    byte buf[0x400];
+    size_t pos, len;
+} pending;
+
+/* Waits for input, at most timeout milliseconds if nonnegative.
+ * Without a timeout, returns early when an event is posted. */
+static bool fill_tty(int timeout)
 {
-    int c;
-    errno = 0;
-    if (EOF == (c = getc(stdin))) {
-        if (errno == EINTR)
-            return KEY_INTERRUPTED;
-        pdie("getc");
-    }
-    return c;
+    struct pollfd pfd[2] = {
+        {.fd = fileno(stdin), .events = POLLIN},
+        {.fd = event_fd(), .events = POLLIN},
+    };
+    ssize_t r;
+
+    do {
+        if (0 > (r = poll(pfd, timeout < 0 ? 2 : 1, timeout)) && errno != EINTR)
+            pdie("poll");
+        if (!r || (timeout < 0 && (pfd[1].revents & POLLIN)))
+            return false;
+    } while (r < 0 || !pfd[0].revents);
+
+    do
+        r = read(fileno(stdin), pending.buf, sizeof(pending.buf));
+    while (r < 0 && errno == EINTR);
+    if (r <= 0)
+        pdie("read");
+
+    pending.len = r;
+    return true;
 }
 
-static void ungetch(int c)
+/* like fill_tty(), but reads from the key script */
+static bool fill_replay(int timeout)
 {
-    if (c != ungetc(c, stdin))
-        pdie("ungetc");
+    struct pollfd pfd = {.fd = event_fd(), .events = POLLIN};
+
+    /* never block on a script, but still let events through */
+    if (timeout < 0 && poll(&pfd, 1, 0) > 0)
+        return false;
+
+    pending.len = replay_read(pending.buf, sizeof(pending.buf), timeout < 0 ? -1 : timeout * 1000);
+    return pending.len;
 }
 
-static key get_key(void)
+static bool fill(int timeout)
 {
-    static const struct itimerval timeout = {{0}, {CONFIG_WAIT_ESCAPE / 1000000, CONFIG_WAIT_ESCAPE % 1000000}};
-    static const struct itimerval stop = {0};
-
-    /* FIXME Perhaps it'd be easier to just memorize everything after an escape
-     * key until the timeout hits and parse it once we got the whole sequence? */
-    static enum {
-        none,
-        discard,
-        have_escape,
-        have_bracket,
-        need_tilde,
-    } state = none;
-    static key r;
-    static uint64_t tick;
+    uint64_t t = monotonic_microtime();
+    bool ok;
 
-    key k;
+    assert(pending.pos == pending.len);
 
-    /* If we already saw an escape key and we're at the beginning of the
-     * function again, it is likely we were interrupted by the timer.
-     * Check if we've waited long enough for the rest of an escape sequence;
-     * if yes, we either return the escape key or stop discarding input. */
-    if ((state == have_escape || state == discard)
-            && monotonic_microtime() - tick >= CONFIG_WAIT_ESCAPE) {
-        switch (state) {
-        case have_escape:
-            state = none;
-            r = KEY_SPECIAL_ESCAPE;
-            goto stop_timer;
-        case discard:
-            state = none;
-            if (setitimer(ITIMER_REAL, &stop, NULL))
-                pdie("setitimer");
-            break;
-        default:
-            die("unexpected state");
-        }
+    if (replay.in) {
+        ok = fill_replay(timeout);
+    }
+    else {
+        ok = fill_tty(timeout);
+        stats.wait += monotonic_microtime() - t;
+        if (ok && replay.out)
+            record_write(pending.buf, pending.len);
     }
 
-next:
+    if (!ok) {
+        pending.len = pending.pos;
+        return false;
+    }
 
-    /* This might be a window size change or a timer interrupt, so we need to
-     * go up to the main loop.  The state machine is untouched by this; we
-     * can simply continue where we were as soon as we're called again. */
-    if ((k = getch()) == KEY_INTERRUPTED)
-        longjmp(jmp_mainloop, 0);
+    if (replay_active())
+        replay.arrival = monotonic_microtime();
+    pending.pos = 0;
+    return true;
+}
+
+/* returns KEY_INTERRUPTED if an event came first */
+static key getch(void)
+{
+    if (pending.pos == pending.len && !fill(-1))
+        return KEY_INTERRUPTED;
+    return pending.buf[pending.pos++];
+}
 
-    switch (state) {
+/* for the rest of an escape sequence; returns KEY_INTERRUPTED on timeout */
+static key getch_wait(void)
+{
+    if (pending.pos == pending.len && !fill(CONFIG_WAIT_ESCAPE / 1000))
+        return KEY_INTERRUPTED;
+    return pending.buf[pending.pos++];
+}
 
-    case none:
-        if (k != 0x1b)
-            return k;
+static void ungetch(int c)
+{
+    assert(pending.pos);
+    pending.buf[--pending.pos] = c;
+}
 
-        state = have_escape;
-start_timer:
-        tick = monotonic_microtime();
-        if (setitimer(ITIMER_REAL, &timeout, NULL))
-            pdie("setitimer");
-        goto next;
+/* is there input we can process without blocking? */
+bool input_pending(void)
+{
+    struct pollfd pfd = {.fd = fileno(stdin), .events = POLLIN};
 
-    case discard:
-        goto next;
+    if (pending.pos < pending.len)
+        return true;
+    if (replay.in)
+        return false; /* one frame per recorded read */
+    return poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLIN);
+}
 
-    case have_escape:
-        if (k != '[') {
-            ungetch(k);
-            state = none;
-            r = KEY_SPECIAL_ESCAPE;
-            goto stop_timer;
-        }
-        state = have_bracket;
-        goto next;
+/* Parses the rest of "\x1b[<button;x;y" plus M or m (for releases).
+ * Returns KEY_MOUSE for clicks, arrows for the wheel, zero otherwise. */
+static key get_mouse(void)
+{
+    unsigned v[3] = {0}, i = 0;
+    key k;
 
-    case have_bracket:
-        switch (k) {
-        case 'A': state = none; r = KEY_SPECIAL_UP; goto stop_timer;
-        case 'B': state = none; r = KEY_SPECIAL_DOWN; goto stop_timer;
-        case 'C': state = none; r = KEY_SPECIAL_RIGHT; goto stop_timer;
-        case 'D': state = none; r = KEY_SPECIAL_LEFT; goto stop_timer;
-        case 'F': state = none; r = KEY_SPECIAL_END; goto stop_timer;
-        case 'H': state = none; r = KEY_SPECIAL_HOME; goto stop_timer;
-        case '3': state = need_tilde; r = KEY_SPECIAL_DELETE; goto next;
-        case '5': state = need_tilde; r = KEY_SPECIAL_PGUP; goto next;
-        case '6': state = need_tilde; r = KEY_SPECIAL_PGDOWN; goto next;
-        case '7': state = need_tilde; r = KEY_SPECIAL_HOME; goto next;
-        case '8': state = need_tilde; r = KEY_SPECIAL_END; goto next;
-        default:
-discard_sequence:
-              /* We don't know this one. Enter discarding state and
-               * wait for all the characters to come in. */
-              state = discard;
-              goto start_timer;
-        }
-
-    case need_tilde:
-        if (k != '~')
-            goto discard_sequence;
-        state = none;
-stop_timer:
-        setitimer(ITIMER_REAL, &stop, NULL);
-        return r;
+    while ((k = getch_wait()) != KEY_INTERRUPTED) {
+        if (k >= '0' && k <= '9')
+            v[i] = 10 * v[i] + (k - '0');
+        else if (k == ';' && i < 2)
+            ++i;
+        else
+            break;
+    }
+    if (k != 'M' || i != 2 || !v[1] || !v[2])
+        return 0;
+
+    switch (v[0] & ~(4 | 8 | 16) /* modifiers */) {
+    case 0:
+        mouse.x = v[1] - 1;
+        mouse.y = v[2] - 1;
+        return KEY_MOUSE;
+    case 64: return KEY_SPECIAL_UP;
+    case 65: return KEY_SPECIAL_DOWN;
+    }
+    return 0;
+}
+
+/* returns KEY_INTERRUPTED when the main loop has events to handle */
+static key get_key(void)
+{
+    key k, r;
+
+again:
+    if ((k = getch()) != 0x1b)
+        return k;
+
+    /* A lone escape key, or the start of an escape sequence?
+     * Only the timing can tell. */
+    if ((k = getch_wait()) == KEY_INTERRUPTED)
+        return KEY_SPECIAL_ESCAPE;
+    if (k != '[') {
+        ungetch(k);
+        return KEY_SPECIAL_ESCAPE;
+    }
+
+    switch (k = getch_wait()) {
+    case 'A': return KEY_SPECIAL_UP;
+    case 'B': return KEY_SPECIAL_DOWN;
+    case 'C': return KEY_SPECIAL_RIGHT;
+    case 'D': return KEY_SPECIAL_LEFT;
+    case 'F': return KEY_SPECIAL_END;
+    case 'H': return KEY_SPECIAL_HOME;
+    case '3': r = KEY_SPECIAL_DELETE; break;
+    case '5': r = KEY_SPECIAL_PGUP; break;
+    case '6': r = KEY_SPECIAL_PGDOWN; break;
+    case '7': r = KEY_SPECIAL_HOME; break;
+    case '8': r = KEY_SPECIAL_END; break;
+    case '<':
+        if (!(k = get_mouse()))
+            goto again;
+        return k;
+    default: goto discard;
     }
 
-    __builtin_unreachable();
+    if ((k = getch_wait()) == '~')
+        return r;
+
+discard:
+    /* We don't know this one. Skip to the final byte of the sequence,
+     * or until the terminal stops sending. */
+    while (k != KEY_INTERRUPTED && !(k >= 0x40 && k <= 0x7e))
+        k = getch_wait();
+    goto again;
 }
 
-static char *get_line(char c)
+/* Returns false if interrupted; the line is kept for the next call.
+ * Otherwise, *ret is the line or NULL if the user cancelled. */
+static bool get_line(char c, char **ret)
 {
     static size_t cap = 0, len = 0;
     static char *str = NULL;
-    char *ret = NULL;
+    bool done = true;
+
+    *ret = NULL;
 
     /* FIXME this disrespects the view->color flag */
     printf("%s%s%c%s%s", bold_on, color_yellow, c, bold_off, color_normal);
@@ -189,6 +272,9 @@ static char *get_line(char c)
         key k = get_key();
 
         switch (k) {
+        case KEY_INTERRUPTED:
+            done = false;
+            goto out;
         case KEY_SPECIAL_ESCAPE:
             len = 0;
             goto out;
@@ -213,7 +299,7 @@ static char *get_line(char c)
 
 eol:
     str[len] = 0;
-    ret = str;
+    *ret = str;
     cap = len = 0;
     str = NULL;
 
@@ -221,7 +307,7 @@ out:
     fputs(hide_cursor, stdout);
     fflush(stdout);
 
-    return ret;
+    return done;
 }
 
 static void do_reset_soft(struct input *input)
@@ -435,6 +521,8 @@ static bool do_delete(struct input *input, bool back)
 static void do_quit(struct input *input, bool *quit, bool force)
 {
     struct view *V = input->view;
+    if (pane_close())
+        return; /* the blob is still shown elsewhere */
     if (force || blob_is_saved(V->blob))
         *quit = true;
     else
@@ -450,7 +538,9 @@ static void do_search_cont(struct input *input, ssize_t dir)
         return;
 
     size_t cur = dir > 0 ? min(input->cur, blen-1) : input->cur;
-    ssize_t pos = blob_search(V->blob, input->search.needle, input->search.len, (cur + blen + dir) % blen, dir);
+    uint64_t t = monotonic_microtime();
+    ssize_t pos = search_next(&input->search, V->blob, (cur + blen + dir) % blen, dir);
+    stats_since(STAT_SEARCH, t);
 
     if (pos < 0)
         return;
@@ -459,6 +549,180 @@ static void do_search_cont(struct input *input, ssize_t dir)
     input->cur = pos;
     view_dirty_at(V, input->cur);
     view_adjust(V);
+
+    if (input->search.type == SEARCH_APPROX) {
+        char buf[64];
+        snprintf(buf, sizeof(buf), "match at distance %zu.",
+                search_distance(&input->search, V->blob, pos));
+        view_message(V, buf, COLOR_NORMAL);
+    }
+}
+
+static void do_class_jump(struct input *input, ssize_t dir)
+{
+    struct view *V = input->view;
+    size_t blen = blob_length(V->blob);
+
+    if (!blen)
+        return;
+
+    uint64_t t = monotonic_microtime();
+    size_t pos = search_class_change(V->blob, min(input->cur, blen - 1), dir);
+    stats_since(STAT_SEARCH, t);
+
+    view_dirty_at(V, input->cur);
+    input->cur = min(pos, cur_bound(input) - 1);
+    view_dirty_at(V, input->cur);
+    view_adjust(V);
+}
+
+static void do_split(struct input *input, bool side_by_side)
+{
+    struct view *V = input->view;
+    if (V->peer)
+        view_error(V, "can't split in diff mode.");
+    else if (!pane_split(side_by_side))
+        view_error(V, "not enough room.");
+}
+
+static void do_close(struct input *input)
+{
+    if (!pane_close())
+        view_error(input->view, "can't close the last pane.");
+}
+
+/* ctrl+W and another key for panes, as in vim */
+static void do_pane(struct input *input, key k)
+{
+    switch (k) {
+    case 's': case 'S': case 0x13:
+        do_split(input, false);
+        break;
+    case 'v': case 'V': case 0x16:
+        do_split(input, true);
+        break;
+    case 'w': case 0x17:
+        pane_cycle(+1);
+        break;
+    case 'W':
+        pane_cycle(-1);
+        break;
+    case 'q': case 'c': case 0x11:
+        do_close(input);
+        break;
+    }
+}
+
+/* to the next or previous extent modified since the last save */
+static void do_change_jump(struct input *input, ssize_t dir)
+{
+    struct view *V = input->view;
+    struct blob_extent ext;
+
+    uint64_t t = monotonic_microtime();
+    bool found = blob_next_change(V->blob, input->cur, dir, &ext);
+    stats_since(STAT_SEARCH, t);
+
+    if (!found) {
+        view_message(V, "no more changes.", COLOR_NORMAL);
+        return;
+    }
+
+    view_dirty_at(V, input->cur);
+    input->cur = min(ext.from, cur_bound(input) - 1);
+    view_dirty_at(V, input->cur);
+    view_adjust(V);
+}
+
+/* lists the modified extents from the one at the cursor on */
+static void do_changes(struct input *input)
+{
+    struct view *V = input->view;
+    struct blob_extent *list;
+    size_t count = blob_changes(V->blob, &list), bytes = 0, i, n;
+    char *buf;
+    size_t len;
+    FILE *fp;
+
+    if (!count) {
+        view_message(V, "no changes since the last save.", COLOR_NORMAL);
+        return;
+    }
+
+    for (i = 0; i < count; ++i)
+        bytes += list[i].to - list[i].from;
+    for (i = 0; i + 1 < count && list[i].to <= input->cur && list[i].from < input->cur; ++i);
+
+    if (!(fp = open_memstream(&buf, &len)))
+        pdie("open_memstream");
+    fprintf(fp, "%zu change%s, %zu byte%s in total%s:", count, count == 1 ? "" : "s",
+            bytes, bytes == 1 ? "" : "s", i ? ", from the cursor on" : "");
+    for (n = max(V->rows / 2, 1); n && i < count; --n, ++i) {
+        if (list[i].to > list[i].from)
+            fprintf(fp, "\n%0*zx  %zu byte%s", V->pos_digits, list[i].from,
+                    list[i].to - list[i].from, list[i].to - list[i].from == 1 ? "" : "s");
+        else
+            fprintf(fp, "\n%0*zx  bytes removed", V->pos_digits, list[i].from);
+    }
+    if (i < count)
+        fprintf(fp, "\n... and %zu more", count - i);
+    fclose(fp);
+    view_message(V, buf, COLOR_NORMAL);
+    free(buf);
+    free(list);
+}
+
+/* diff mode: to the next or previous run of differing bytes */
+static void do_diff_jump(struct input *input, ssize_t dir)
+{
+    struct view *V = input->view;
+    struct diff D = {V->blob, V->peer->blob, V->peer->shift - V->shift};
+
+    uint64_t t = monotonic_microtime();
+    ssize_t pos = diff_next(&D, input->cur, dir);
+    stats_since(STAT_SEARCH, t);
+
+    if (pos < 0) {
+        view_message(V, "no more differences.", COLOR_NORMAL);
+        return;
+    }
+    if ((size_t) pos >= cur_bound(input)) {
+        pos = cur_bound(input) - 1;
+        view_message(V, "the other file goes on after the end of this one.", COLOR_NORMAL);
+    }
+
+    view_dirty_at(V, input->cur);
+    input->cur = pos;
+    view_dirty_at(V, input->cur);
+    view_adjust(V);
+}
+
+/* diff mode: shifts the other side by the given or a guessed offset */
+static void do_align(struct input *input, char const *arg)
+{
+    struct view *V = input->view;
+    struct diff D = {V->blob, V->peer->blob, V->peer->shift - V->shift};
+    ssize_t shift;
+    char buf[64];
+
+    if (arg) {
+        char *end;
+        errno = 0;
+        shift = strtoll(arg, &end, 0);
+        if (errno || *end) {
+            view_error(V, "usage: align [offset]");
+            return;
+        }
+    }
+    else if (!diff_align(&D, input->cur, &shift)) {
+        view_error(V, "can't find where the files line up again.");
+        return;
+    }
+
+    V->peer->shift = V->shift + shift;
+    view_dirty_from(V, 0);
+    snprintf(buf, sizeof(buf), "other file shifted by %+zd bytes.", shift);
+    view_message(V, buf, COLOR_NORMAL);
 }
 
 static void do_inc_dec(struct input *input, byte diff)
@@ -478,6 +742,334 @@ static void do_inc_dec(struct input *input, byte diff)
     view_dirty_at(V, input->cur);
 }
 
+/* don't redraw the progress more often than this, in microseconds */
+#define PROGRESS_INTERVAL 100000
+
+/* how far a long command got, shown on the command line */
+struct progress {
+    char const *what;
+    unsigned row;
+    uint64_t last;
+};
+
+static void show_progress(void *arg, size_t done, size_t total)
+{
+    struct progress *P = arg;
+    uint64_t now = monotonic_microtime();
+
+    if (done == total || now - P->last < PROGRESS_INTERVAL)
+        return;
+    P->last = now;
+
+    cursor_line(P->row);
+    printf("%s%s... %u%%", clear_line, P->what, (unsigned) (100. * done / total));
+    fflush(stdout);
+}
+
+/* what a command works on; complains if nothing is selected */
+static bool get_selection(struct input *input, size_t *pos, size_t *len)
+{
+    if (input->old_mode != SELECT) {
+        view_error(input->view, "nothing selected.");
+        return false;
+    }
+    *pos = min(input->cur, input->sel);
+    *len = absdiff(input->cur, input->sel) + 1;
+    return true;
+}
+
+/* :xor, :add, :rol, :bswap on the selection */
+static void do_transform(struct input *input, struct transform const *T, char const *what)
+{
+    struct view *V = input->view;
+    struct progress P = {what, V->top + V->rows - 1, monotonic_microtime()};
+    size_t pos, len;
+    char buf[64];
+
+    if (!get_selection(input, &pos, &len))
+        return;
+    if (T->op == TRANSFORM_BSWAP && len % T->n) {
+        snprintf(buf, sizeof(buf), "selection isn't a multiple of %u bytes.", T->n);
+        view_error(V, buf);
+        return;
+    }
+
+    transform_apply(V->blob, pos, len, T, show_progress, &P);
+}
+
+/* of the selection or the whole file; "w" also writes the digest at the cursor, "wle" a CRC little-endian */
+static void do_hash(struct input *input, enum hash_algo algo, char const *what, char const *arg)
+{
+    struct view *V = input->view;
+    struct blob *B = V->blob;
+    struct progress P = {what, V->top + V->rows - 1, monotonic_microtime()};
+    bool crc = algo == HASH_CRC32 || algo == HASH_CRC32C, sel = input->old_mode == SELECT;
+    size_t pos = sel ? min(input->cur, input->sel) : 0;
+    size_t len = sel ? absdiff(input->cur, input->sel) + 1 : blob_length(B);
+    byte digest[HASH_MAX_LEN], out[HASH_MAX_LEN];
+    char buf[0x100];
+    size_t n;
+    int k;
+
+    if (arg && strcmp(arg, "w") && !(crc && !strcmp(arg, "wle"))) {
+        snprintf(buf, sizeof(buf), "usage: %s [w%s]", what, crc ? "|wle" : "");
+        view_error(V, buf);
+        return;
+    }
+
+    n = hash_range(B, pos, len, algo, digest, show_progress, &P);
+
+    k = snprintf(buf, sizeof(buf), "%s of the %s (%zu byte%s):\n", what,
+            sel ? "selection" : "file", len, len == 1 ? "" : "s");
+    for (size_t i = 0; i < n; ++i)
+        k += snprintf(buf + k, sizeof(buf) - k, "%02x", digest[i]);
+    view_message(V, buf, COLOR_NORMAL);
+
+    if (!arg)
+        return;
+    for (size_t i = 0; i < n; ++i)
+        out[i] = digest[strcmp(arg, "wle") ? i : n - 1 - i];
+    if (input->cur + n > blob_length(B)) {
+        view_error(V, "no room for the digest at the cursor.");
+        return;
+    }
+    blob_replace(B, input->cur, out, n, true);
+}
+
+static bool dups_usable(struct input *input)
+{
+    if (!input->dups.blob) {
+        view_error(input->view, "no index of blocks; use :dups first.");
+        return false;
+    }
+    if (input->dups.stale) {
+        view_error(input->view, "the file changed; use :dups again.");
+        return false;
+    }
+    return true;
+}
+
+static void dups_goto(struct input *input, size_t pos, char const *msg)
+{
+    struct view *V = input->view;
+
+    view_dirty_at(V, input->cur);
+    input->cur = min(pos, cur_bound(input) - 1);
+    view_dirty_at(V, input->cur);
+    view_adjust(V);
+    view_message(V, msg, COLOR_NORMAL);
+}
+
+/* to the first block of the next or previous group of identical blocks */
+static void do_dups_group(struct input *input, ssize_t dir)
+{
+    struct dups const *D = &input->dups;
+    size_t pos, g;
+    char buf[64];
+
+    if (!dups_usable(input))
+        return;
+    if (!dups_next_group(D, input->cur, dir, &pos, &g)) {
+        view_message(input->view, "no identical blocks.", COLOR_NORMAL);
+        return;
+    }
+    snprintf(buf, sizeof(buf), "group %zu of %zu: %zu copies.", g + 1, D->groups,
+            D->start[g + 1] - D->start[g]);
+    dups_goto(input, pos, buf);
+}
+
+/* to the next or previous copy of the block at the cursor */
+static void do_dups_copy(struct input *input, ssize_t dir)
+{
+    size_t pos, k, n;
+    char buf[64];
+
+    if (!dups_usable(input))
+        return;
+    if (!dups_next_copy(&input->dups, input->cur, dir, &pos, &k, &n)) {
+        view_message(input->view, "no other copies of this block.", COLOR_NORMAL);
+        return;
+    }
+    snprintf(buf, sizeof(buf), "copy %zu of %zu.", k + 1, n);
+    dups_goto(input, pos, buf);
+}
+
+static void do_dups(struct input *input, char const *arg)
+{
+    struct view *V = input->view;
+    struct dups *D = &input->dups;
+    struct progress P = {"dups", V->top + V->rows - 1, monotonic_microtime()};
+    size_t block = 0x1000;
+    char buf[0x100];
+
+    if (arg) {
+        char *end;
+        errno = 0;
+        block = strtoull(arg, &end, 0);
+        if (errno || *end) {
+            view_error(V, "usage: dups [block size]");
+            return;
+        }
+    }
+    if (block < DUPS_MIN_BLOCK || block > DUPS_MAX_BLOCK) {
+        snprintf(buf, sizeof(buf), "block size must be from %u bytes to %zu MiB.",
+                DUPS_MIN_BLOCK, DUPS_MAX_BLOCK >> 20);
+        view_error(V, buf);
+        return;
+    }
+
+    dups_find(D, V->blob, block, show_progress, &P);
+
+    if (!D->groups)
+        snprintf(buf, sizeof(buf), "no identical %zu-byte blocks.", block);
+    else
+        snprintf(buf, sizeof(buf), "%zu group%s of identical %zu-byte blocks, %zu blocks in all.\n"
+                "ctrl+N/P steps through the groups, * and # through the copies.",
+                D->groups, D->groups == 1 ? "" : "s", block, dups_copies(D));
+    view_message(V, buf, COLOR_NORMAL);
+}
+
+/* byte histogram of the selection or the whole file as a bar chart, with a summary */
+static void do_hist(struct input *input)
+{
+    struct view *V = input->view;
+    struct progress P = {"hist", V->top + V->rows - 1, monotonic_microtime()};
+    bool sel = input->old_mode == SELECT;
+    size_t pos = sel ? min(input->cur, input->sel) : 0;
+    size_t len = sel ? absdiff(input->cur, input->sel) + 1 : blob_length(V->blob);
+    size_t width = V->width > V->pos_digits + 2 ? V->width - V->pos_digits - 2 : 0;
+    unsigned cols, rows = V->rows > 5 ? min(V->rows - 5, 8) : 0;
+    unsigned distinct = 0, lo = 0xff, hi = 0, common = 0;
+    uint64_t sums[256], top = 0, printable = 0;
+    struct histogram H;
+    char *buf;
+    size_t buf_len;
+    FILE *fp;
+
+    if (!len) {
+        view_message(V, "nothing to count.", COLOR_NORMAL);
+        return;
+    }
+
+    histogram_range(V->blob, pos, len, &H, show_progress, &P);
+
+    for (unsigned b = 0; b < 256; ++b) {
+        if (!H.count[b])
+            continue;
+        ++distinct;
+        lo = min(lo, b);
+        hi = max(hi, b);
+        if (H.count[b] > H.count[common])
+            common = b;
+        if (b >= 0x20 && b < 0x7f)
+            printable += H.count[b];
+    }
+
+    /* as many bytes per column as it takes to fit */
+    for (cols = 256; cols > 16 && cols > width; cols /= 2);
+    if (cols > width)
+        rows = 0;
+    for (unsigned c = 0; c < cols; ++c) {
+        sums[c] = 0;
+        for (unsigned b = c * (256 / cols); b < (c + 1) * (256 / cols); ++b)
+            sums[c] += H.count[b];
+        top = max(top, sums[c]);
+    }
+
+    if (!(fp = open_memstream(&buf, &buf_len)))
+        pdie("open_memstream");
+    fprintf(fp, "bytes of the %s (%zu byte%s)%s", sel ? "selection" : "file",
+            len, len == 1 ? "" : "s", rows ? ", log scale:" : ":");
+    for (unsigned r = rows; r--; ) {
+        fputc('\n', fp);
+        for (unsigned c = 0; c < cols; ++c) {
+            double h = log1p((double) sums[c]) / log1p((double) top) * rows;
+            fputc(h >= r + 1 ? '#' : h > r ? '.' : ' ', fp);
+        }
+    }
+    if (rows) {
+        unsigned step = cols >= 64 ? 16 : 8;
+        fputc('\n', fp);
+        for (unsigned c = 0; c < cols; c += step)
+            fprintf(fp, "%02x%*s", c * (256 / cols), (int) step - 2, "");
+    }
+    fprintf(fp, "\nentropy %.3f bits/byte, %u value%s from %02x to %02x",
+            histogram_entropy(&H), distinct, distinct == 1 ? "" : "s", lo, hi);
+    fprintf(fp, "\nzeros %.1f%%, printable %.1f%%, most common %02x (%.1f%%)",
+            100. * H.count[0] / len, 100. * printable / len, common, 100. * H.count[common] / len);
+    fclose(fp);
+    view_message(V, buf, COLOR_NORMAL);
+    free(buf);
+}
+
+/* block hashes are kept from the first use on, for whichever file was asked about last */
+static void merkle_ready(struct input *input, char const *what)
+{
+    struct view *V = input->view;
+    struct progress P = {what, V->top + V->rows - 1, monotonic_microtime()};
+
+    if (!merkle_running(V->blob)) {
+        merkle_stop();
+        merkle_start(V->blob);
+    }
+    merkle_wait(show_progress, &P);
+}
+
+/* the root, or the digest of the selection */
+static void do_merkle(struct input *input)
+{
+    bool sel = input->old_mode == SELECT;
+    size_t pos = min(input->cur, input->sel), len = absdiff(input->cur, input->sel) + 1;
+    byte digest[SHA256_LEN];
+    char buf[0x100];
+    int k;
+
+    merkle_ready(input, "merkle");
+    if (sel)
+        merkle_range(pos, min(pos + len, blob_length(input->view->blob)), digest);
+    else
+        merkle_root(digest);
+
+    if (sel)
+        k = snprintf(buf, sizeof(buf), "merkle digest of the selection (%zu byte%s, %zu KiB blocks):\n",
+                len, len == 1 ? "" : "s", MERKLE_BLOCK >> 10);
+    else
+        k = snprintf(buf, sizeof(buf), "merkle root (%zu KiB blocks):\n", MERKLE_BLOCK >> 10);
+    for (size_t i = 0; i < SHA256_LEN; ++i)
+        k += snprintf(buf + k, sizeof(buf) - k, "%02x", digest[i]);
+    view_message(input->view, buf, COLOR_NORMAL);
+}
+
+/* compares the selection or the whole file with the file as last saved */
+static void do_same(struct input *input)
+{
+    struct view *V = input->view;
+    bool sel = input->old_mode == SELECT;
+    size_t pos = sel ? min(input->cur, input->sel) : 0;
+    size_t end = sel ? max(input->cur, input->sel) + 1 : SIZE_MAX;
+    char buf[0x100];
+    size_t diff;
+
+    merkle_ready(input, "same");
+
+    switch (merkle_same(pos, end, &diff)) {
+    case MERKLE_SAME:
+        snprintf(buf, sizeof(buf), "the %s is the same as saved.", sel ? "selection" : "file");
+        view_message(V, buf, COLOR_NORMAL);
+        break;
+    case MERKLE_DIFFERENT:
+        snprintf(buf, sizeof(buf), "the %s differs from the saved file at 0x%zx.",
+                sel ? "selection" : "file", diff);
+        view_message(V, buf, COLOR_NORMAL);
+        break;
+    case MERKLE_NO_FILE:
+        view_error(V, "no saved file to compare with.");
+        break;
+    default:
+        die("unknown comparison result");
+    }
+}
+
 void do_home_end(struct input *input, size_t soft, size_t hard)
 {
     assert(soft <= cur_bound(input));
@@ -516,6 +1108,8 @@ void do_pgup_pgdown(struct input *input, size_t (*f)(size_t, size_t, size_t, siz
 void input_cmd(struct input *input, char *str, bool *quit);
 void input_search(struct input *input, char *str);
 
+static size_t unhex(byte **ret, char const *hex);
+
 void input_get(struct input *input, bool *quit)
 {
     struct view *V = input->view;
@@ -523,11 +1117,14 @@ void input_get(struct input *input, bool *quit)
 
     if (input->mode == COMMAND || input->mode == SEARCH) {
 
-        cursor_line(V->rows - 1); /* move to last line */
+        cursor_line(V->top + V->rows - 1); /* move to last line */
         fputs(clear_line, stdout);
+        screen_invalidate(V->top + V->rows - 1);
 
         char c = input->mode == COMMAND ? ':' : '/';
-        char *str = get_line(c);
+        char *str;
+        if (!get_line(c, &str))
+            return; /* back to the main loop, then continue editing */
 
         if (str) {
             switch (input->mode) {
@@ -553,6 +1150,9 @@ void input_get(struct input *input, bool *quit)
 
     key k = get_key();
 
+    if (k == KEY_INTERRUPTED)
+        return; /* back to the main loop */
+
     if (input->mode == INPUT) {
 
         if (input->mode_ascii && isprint(k)) {
@@ -705,14 +1305,30 @@ void input_get(struct input *input, bool *quit)
                  input->cur,
                  blob_length(input->view->blob),
                  ((input->cur+1) * 100) / blob_length(input->view->blob));
-             view_message(V, buf, NULL);
+             view_message(V, buf, COLOR_NORMAL);
         }
         break;
 
+    case 0x17: /* ctrl + W */
+        do_pane(input, get_key());
+        break;
+
     case 0xc: /* ctrl + L */
         view_dirty_from(V, 0);
         break;
 
+    case KEY_MOUSE:
+        {
+            size_t pos;
+            if (!view_map_pos(V, mouse.x, mouse.y, &pos))
+                break;
+            view_dirty_at(V, input->cur);
+            input->cur = min(pos, cur_bound(input) - 1);
+            view_dirty_at(V, input->cur);
+            view_adjust(V);
+        }
+        break;
+
     case ':':
         input->old_mode = input->mode;
         input->mode = COMMAND;
@@ -731,6 +1347,38 @@ void input_get(struct input *input, bool *quit)
         do_search_cont(input, -1);
         break;
 
+    case '}':
+        do_class_jump(input, +1);
+        break;
+
+    case '{':
+        do_class_jump(input, -1);
+        break;
+
+    case ')':
+        do_change_jump(input, +1);
+        break;
+
+    case '(':
+        do_change_jump(input, -1);
+        break;
+
+    case 0xe: /* ctrl + N */
+        do_dups_group(input, +1);
+        break;
+
+    case 0x10: /* ctrl + P */
+        do_dups_group(input, -1);
+        break;
+
+    case '*':
+        do_dups_copy(input, +1);
+        break;
+
+    case '#':
+        do_dups_copy(input, -1);
+        break;
+
     case 0x1: /* ctrl + A */
         do_inc_dec(input, 1);
         break;
@@ -788,11 +1436,18 @@ void input_get(struct input *input, bool *quit)
         break;
 
     case '[':
-        view_set_cols(V, true, -1);
-        break;
-
     case ']':
-        view_set_cols(V, true, +1);
+        if (V->peer) {
+            /* [c and ]c in diff mode */
+            key c = get_key();
+            if (c == 'c') {
+                do_diff_jump(input, k == ']' ? +1 : -1);
+                break;
+            }
+            if (c < 0x100)
+                ungetch(c);
+        }
+        view_set_cols(V, true, k == ']' ? +1 : -1);
         break;
 
     }
@@ -809,6 +1464,7 @@ void input_cmd(struct input *input, char *str, bool *quit)
     else if (!strcmp(p, "w") || !strcmp(p, "wq")) {
         switch (blob_save(V->blob, strtok(NULL, " "))) {
         case BLOB_SAVE_OK:
+            merkle_saved(V->blob);
             if (!strcmp(p, "wq"))
                 do_quit(input, quit, false);
             break;
@@ -860,6 +1516,106 @@ void input_cmd(struct input *input, char *str, bool *quit)
             view_recompute(V, true);
         }
     }
+    else if (!strcmp(p, "map")) {
+        if (!(p = strtok(NULL, " "))) {
+            view_map(V, !V->map);
+        }
+        else if (!strcmp(p, "+") || !strcmp(p, "-")) {
+            if (!V->map)
+                view_map(V, true);
+            view_map_zoom(V, *p == '+');
+        }
+        else {
+            view_map(V, *p == '1' || *p == 'y');
+        }
+    }
+    else if (!strcmp(p, "align")) {
+        if (!V->peer)
+            view_error(V, "not in diff mode.");
+        else
+            do_align(input, strtok(NULL, " "));
+    }
+    else if (!strcmp(p, "split") || !strcmp(p, "sp")) {
+        do_split(input, false);
+    }
+    else if (!strcmp(p, "vsplit") || !strcmp(p, "vs")) {
+        do_split(input, true);
+    }
+    else if (!strcmp(p, "close") || !strcmp(p, "clo")) {
+        do_close(input);
+    }
+    else if (!strcmp(p, "changes")) {
+        do_changes(input);
+    }
+    else if (!strcmp(p, "xor") || !strcmp(p, "add")) {
+        struct transform T = {.op = *p == 'x' ? TRANSFORM_XOR : TRANSFORM_ADD};
+        char const *what = p;
+        byte *key = NULL;
+        if (!(p = strtok(NULL, " ")) || !(T.key_len = unhex(&key, p))) {
+            view_error(V, *what == 'x' ? "usage: xor <hex key>" : "usage: add <hex key>");
+        }
+        else {
+            T.key = key;
+            do_transform(input, &T, what);
+        }
+        free(key);
+    }
+    else if (!strcmp(p, "fill")) {
+        byte *pattern = NULL;
+        size_t n, pos, len;
+        if (!(p = strtok(NULL, " ")) || !(n = unhex(&pattern, p)))
+            view_error(V, "usage: fill <hex pattern>");
+        else if (get_selection(input, &pos, &len))
+            blob_fill(V->blob, pos, len, pattern, n, true);
+        free(pattern);
+    }
+    else if (!strcmp(p, "rol")) {
+        char *end = NULL;
+        long n = 0;
+        if ((p = strtok(NULL, " ")))
+            n = strtol(p, &end, 0);
+        if (!p || *end) {
+            view_error(V, "usage: rol <bits>");
+        }
+        else {
+            struct transform T = {.op = TRANSFORM_ROL, .n = (n % 8 + 8) % 8};
+            do_transform(input, &T, "rol");
+        }
+    }
+    else if (!strcmp(p, "bswap16") || !strcmp(p, "bswap32") || !strcmp(p, "bswap64")) {
+        struct transform T = {.op = TRANSFORM_BSWAP, .n = atoi(p + strlen("bswap")) / 8};
+        do_transform(input, &T, p);
+    }
+    else if (!strcmp(p, "crc32") || !strcmp(p, "crc32c") || !strcmp(p, "md5") || !strcmp(p, "sha256")) {
+        enum hash_algo algo = !strcmp(p, "crc32") ? HASH_CRC32
+                            : !strcmp(p, "crc32c") ? HASH_CRC32C
+                            : !strcmp(p, "md5") ? HASH_MD5 : HASH_SHA256;
+        do_hash(input, algo, p, strtok(NULL, " "));
+    }
+    else if (!strcmp(p, "hist")) {
+        do_hist(input);
+    }
+    else if (!strcmp(p, "dups")) {
+        do_dups(input, strtok(NULL, " "));
+    }
+    else if (!strcmp(p, "merkle")) {
+        do_merkle(input);
+    }
+    else if (!strcmp(p, "same")) {
+        do_same(input);
+    }
+    else if (!strcmp(p, "stats")) {
+        char *buf;
+        size_t len;
+        FILE *fp;
+        if (!(fp = open_memstream(&buf, &len)))
+            pdie("open_memstream");
+        stats_print(fp, V->blob);
+        fclose(fp);
+        buf[len - 1] = 0; /* no empty last line */
+        view_message(V, buf, COLOR_NORMAL);
+        free(buf);
+    }
     else {
         /* try to interpret the input as an offset */
         unsigned long long n = strtoull(p, &p, 0);
@@ -935,12 +1691,16 @@ void input_search(struct input *input, char *str)
 {
     char *p, *q;
 
-    input->search.len = 0;
-    free(input->search.needle);
-    input->search.needle = NULL;
+    search_free(&input->search);
 
     if (!(p = strtok(str, " ")))
         return;
+    else if (strchr("iuf", *p) && isdigit(p[1]) && (q = strtok(NULL, " "))) {
+        if (!search_value(&input->search, p, q, strtok(NULL, " "))) {
+            view_error(input->view, "invalid value.");
+            return;
+        }
+    }
     else if (!strcmp(p, "x") || !strcmp(p, "w")) {
         size_t (*fun)(byte **, char const *) = (*p == 'x') ? unhex : utf8_to_ucs2;
         if (!(q = strtok(NULL, " "))) {
@@ -949,6 +1709,38 @@ void input_search(struct input *input, char *str)
         }
         input->search.len = fun(&input->search.needle, q);
     }
+    else if (!strcmp(p, "~") || !strcmp(p, "~b")) {
+        byte *needle = NULL;
+        size_t len = 0;
+        unsigned long long k = 0;
+        if (!(q = strtok(NULL, " ")) || (k = strtoull(q, &q, 0), *q)
+                || !(q = strtok(NULL, "")) || !(len = unhex(&needle, q))) {
+            free(needle);
+            view_error(input->view, "usage: /~ (distance) (hex string)");
+            return;
+        }
+        bool ok = search_approx(&input->search, needle, len, k, p[1] == 'b');
+        free(needle);
+        if (!ok) {
+            view_error(input->view, "distance too large.");
+            return;
+        }
+    }
+    else if (!strcmp(p, "si") || !strcmp(p, "wi")) {
+        if (!(q = strtok(NULL, *p == 's' ? "" : " "))) {
+            q = p;
+            goto str;
+        }
+        if (*p == 's') {
+            search_nocase(&input->search, (byte const *) q, strlen(q), 1);
+        }
+        else {
+            byte *needle;
+            size_t len = utf8_to_ucs2(&needle, q);
+            search_nocase(&input->search, needle, len, 2);
+            free(needle);
+        }
+    }
     else if (!strcmp(p, "s")) {
         if (!(q = strtok(NULL, "")))
             q = p;
@@ -2,6 +2,8 @@
 #define INPUT_H
 
 #include "common.h"
+#include "search.h"
+#include "dups.h"
 
 struct view;
 
@@ -15,10 +17,8 @@ struct input {
     bool low_nibble;
     byte cur_val;
 
-    struct {
-        size_t len;
-        byte *needle;
-    } search;
+    struct search search;
+    struct dups dups;
 
     bool quit;
 };
@@ -26,6 +26,7 @@ struct input {
 void input_init(struct input *input, struct view *view);
 void input_free(struct input *input);
 
+bool input_pending(void);
 void input_get(struct input *input, bool *quit);
 
 #endif
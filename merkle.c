@@ -0,0 +1,550 @@
+
+#define _GNU_SOURCE
+
+#include "merkle.h"
+
+#include <assert.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "blob.h"
+#include "hash.h"
+
+#define MAX_THREADS 8
+
+/* what's known about a block of the file as saved */
+enum saved_state {
+    SAVED_KNOWN,    /* its hash is in saved[] */
+    SAVED_AS_BLOB,  /* the blob's block is the same */
+    SAVED_ON_DISK,  /* to be hashed from the file */
+    SAVED_HASHING,  /* ... which a worker is doing */
+};
+
+struct node {
+    byte digest[SHA256_LEN];
+    size_t missing;  /* blocks below that aren't hashed yet */
+};
+
+static struct {
+    struct blob *blob;
+    struct blob_observer observer;
+
+    pthread_t threads[MAX_THREADS];
+    unsigned nthreads;
+    bool stop;
+
+    /* everything below is protected by this */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;  /* there's work */
+    pthread_cond_t idle;  /* work was finished */
+
+    size_t len, blocks;
+    unsigned levels;
+    struct node *level[64];  /* level k has a node per 2^k blocks */
+    uint8_t *dirty;          /* per block */
+    size_t pending;          /* dirty blocks */
+    size_t next;             /* where to look for dirty blocks */
+
+    int fd;  /* the file as saved, or -1 */
+    size_t saved_len, saved_blocks;
+    byte (*saved)[SHA256_LEN];
+    uint8_t *saved_state;
+    size_t on_disk, hashing;  /* blocks in these states */
+    size_t disk_next;         /* no block before it is on disk */
+    unsigned generation;      /* of the saved file; older hashes of it don't count */
+} mt = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+    .idle = PTHREAD_COND_INITIALIZER,
+    .fd = -1,
+};
+
+static size_t level_size(unsigned k)
+{
+    return (mt.blocks + ((size_t) 1 << k) - 1) >> k;
+}
+
+static bool done(void)
+{
+    return !mt.pending && !mt.on_disk && !mt.hashing;
+}
+
+/* node i of level k from its children */
+static void combine(unsigned k, size_t i)
+{
+    struct node *n = &mt.level[k][i];
+    struct node const *c = &mt.level[k - 1][2 * i];
+    bool pair = 2 * i + 1 < level_size(k - 1);
+    struct sha256 S;
+
+    n->missing = c[0].missing + (pair ? c[1].missing : 0);
+    if (n->missing)
+        return;
+
+    if (!pair) {
+        memcpy(n->digest, c[0].digest, SHA256_LEN);
+        return;
+    }
+    sha256_init(&S);
+    sha256_update(&S, c[0].digest, SHA256_LEN);
+    sha256_update(&S, c[1].digest, SHA256_LEN);
+    sha256_final(&S, n->digest);
+}
+
+static void propagate(size_t i)
+{
+    for (unsigned k = 1; k < mt.levels; ++k)
+        combine(k, i >>= 1);
+}
+
+static void mark(size_t i)
+{
+    if (!mt.dirty[i]) {
+        mt.dirty[i] = 1;
+        ++mt.pending;
+        mt.level[0][i].missing = 1;
+        propagate(i);
+    }
+}
+
+/* (re)allocates the tree for a blob of length len, keeping the first blocks' hashes */
+static void layout(size_t len, size_t keep)
+{
+    struct node *old = mt.level[0];
+    uint8_t *old_dirty = mt.dirty;
+
+    keep = min(keep, mt.blocks);
+    for (unsigned k = 1; k < mt.levels; ++k)
+        free(mt.level[k]);
+
+    mt.len = len;
+    mt.blocks = (len + MERKLE_BLOCK - 1) / MERKLE_BLOCK;
+    mt.levels = bit_length(max(mt.blocks, 1) - 1) + 1;
+    keep = min(keep, mt.blocks);
+
+    mt.level[0] = malloc_strict(max(mt.blocks, 1) * sizeof(*mt.level[0]));
+    mt.dirty = malloc_strict(max(mt.blocks, 1));
+    mt.pending = 0;
+    for (size_t i = 0; i < mt.blocks; ++i) {
+        if (i < keep && !old_dirty[i]) {
+            mt.level[0][i] = old[i];
+            mt.dirty[i] = 0;
+        }
+        else {
+            mt.level[0][i].missing = 1;
+            mt.dirty[i] = 1;
+            ++mt.pending;
+        }
+    }
+    mt.next = keep;
+    free(old);
+    free(old_dirty);
+
+    for (unsigned k = 1; k < mt.levels; ++k) {
+        mt.level[k] = malloc_strict(level_size(k) * sizeof(*mt.level[k]));
+        for (size_t i = 0; i < level_size(k); ++i)
+            combine(k, i);
+    }
+}
+
+/* block i of the saved file is about to stop being the blob's */
+static void freeze(size_t i)
+{
+    if (i >= mt.saved_blocks || mt.saved_state[i] != SAVED_AS_BLOB)
+        return;
+    if (i < mt.blocks && !mt.dirty[i]) {
+        memcpy(mt.saved[i], mt.level[0][i].digest, SHA256_LEN);
+        mt.saved_state[i] = SAVED_KNOWN;
+    }
+    else {
+        mt.saved_state[i] = SAVED_ON_DISK;
+        ++mt.on_disk;
+        mt.disk_next = min(mt.disk_next, i);
+    }
+}
+
+/* called with the blob locked for writing, so no worker is hashing it */
+static void changed(void *arg, size_t pos, size_t old_len, size_t new_len)
+{
+    size_t len = blob_length(arg), first = pos / MERKLE_BLOCK;
+    /* the contents of everything after an insertion or deletion moved */
+    size_t end = old_len == new_len ? (pos + new_len + MERKLE_BLOCK - 1) / MERKLE_BLOCK
+                                    : max(mt.blocks, mt.saved_blocks);
+
+    pthread_mutex_lock(&mt.lock);
+
+    /* our hashes of these blocks still describe the old contents */
+    for (size_t i = first; i < end; ++i)
+        freeze(i);
+
+    if (len != mt.len)
+        layout(len, first);
+    else
+        for (size_t i = first; i < min(end, mt.blocks); ++i)
+            mark(i);
+
+    pthread_cond_broadcast(&mt.cond);
+    pthread_mutex_unlock(&mt.lock);
+}
+
+/* called with the blob locked for reading, or from the thread that changes it */
+static void hash_part(size_t from, size_t to, byte *digest)
+{
+    struct sha256 S;
+
+    sha256_init(&S);
+    for (size_t n; from < to; from += n) {
+        byte const *p = blob_lookup(mt.blob, from, &n);
+        n = min(n, to - from);
+        sha256_update(&S, p, n);
+    }
+    sha256_final(&S, digest);
+}
+
+/* the file's bytes at [pos, pos + len), as far as there are any */
+static size_t read_saved(int fd, size_t pos, byte *buf, size_t len)
+{
+    size_t got = 0;
+    for (ssize_t r; got < len; got += r)
+        if (0 >= (r = pread(fd, buf + got, len - got, pos + got)))
+            break;
+    return got;
+}
+
+static void hash_saved_block(int fd, size_t i, size_t saved_len, byte *buf, byte *digest)
+{
+    size_t from = i * MERKLE_BLOCK, n = min(MERKLE_BLOCK, saved_len - from);
+    struct sha256 S;
+
+    sha256_init(&S);
+    sha256_update(&S, buf, read_saved(fd, from, buf, n));
+    sha256_final(&S, digest);
+}
+
+static void *worker(void *arg)
+{
+    byte *buf = malloc_strict(MERKLE_BLOCK);
+    byte digest[SHA256_LEN];
+    size_t i;
+
+    (void) arg;
+
+    pthread_mutex_lock(&mt.lock);
+    while (true) {
+        while (!mt.pending && !mt.on_disk && !mt.stop)
+            pthread_cond_wait(&mt.cond, &mt.lock);
+        if (mt.stop)
+            break;
+
+        if (mt.pending) {
+            /* blocks can only change while we don't hold this */
+            pthread_mutex_unlock(&mt.lock);
+            pthread_rwlock_rdlock(&mt.blob->lock);
+            pthread_mutex_lock(&mt.lock);
+
+            for (i = 0; i < mt.blocks; ++i)
+                if (mt.dirty[(mt.next + i) % mt.blocks])
+                    break;
+            if (i < mt.blocks) {
+                i = (mt.next + i) % mt.blocks;
+                mt.dirty[i] = 0;
+                --mt.pending;
+                mt.next = i + 1;
+
+                pthread_mutex_unlock(&mt.lock);
+                hash_part(i * MERKLE_BLOCK, min((i + 1) * MERKLE_BLOCK, mt.len), digest);
+                pthread_mutex_lock(&mt.lock);
+
+                memcpy(mt.level[0][i].digest, digest, SHA256_LEN);
+                mt.level[0][i].missing = 0;
+                propagate(i);
+            }
+
+            pthread_mutex_unlock(&mt.lock);
+            pthread_rwlock_unlock(&mt.blob->lock);
+            pthread_mutex_lock(&mt.lock);
+        }
+        else {
+            for (i = mt.disk_next; mt.saved_state[i] != SAVED_ON_DISK; ++i);
+            mt.saved_state[i] = SAVED_HASHING;
+            mt.disk_next = i + 1;
+            --mt.on_disk;
+            ++mt.hashing;
+            unsigned generation = mt.generation;
+
+            /* saving waits for us before it touches the file descriptor */
+            pthread_mutex_unlock(&mt.lock);
+            hash_saved_block(mt.fd, i, mt.saved_len, buf, digest);
+            pthread_mutex_lock(&mt.lock);
+
+            if (generation == mt.generation) {
+                memcpy(mt.saved[i], digest, SHA256_LEN);
+                mt.saved_state[i] = SAVED_KNOWN;
+            }
+            --mt.hashing;
+        }
+
+        if (done())
+            pthread_cond_broadcast(&mt.idle);
+    }
+    pthread_mutex_unlock(&mt.lock);
+
+    free(buf);
+    return NULL;
+}
+
+/* the saved file's block hashes: the blob's, or to be read from the file */
+static void saved_reset(bool as_blob)
+{
+    mt.saved_blocks = (mt.saved_len + MERKLE_BLOCK - 1) / MERKLE_BLOCK;
+    mt.saved = realloc_strict(mt.saved, max(mt.saved_blocks, 1) * sizeof(*mt.saved));
+    mt.saved_state = realloc_strict(mt.saved_state, max(mt.saved_blocks, 1));
+    memset(mt.saved_state, as_blob ? SAVED_AS_BLOB : SAVED_ON_DISK, mt.saved_blocks);
+    mt.on_disk = as_blob ? 0 : mt.saved_blocks;
+    mt.disk_next = 0;
+    ++mt.generation;
+}
+
+static void saved_open(void)
+{
+    if (mt.fd >= 0 && close(mt.fd))
+        pdie("close");
+    mt.fd = mt.blob->filename ? open(mt.blob->filename, O_RDONLY) : -1;
+}
+
+void merkle_start(struct blob *blob)
+{
+    if (mt.blob)
+        return;
+
+    mt.blob = blob;
+    mt.stop = false;
+
+    pthread_mutex_lock(&mt.lock);
+    layout(blob_length(blob), 0);
+    saved_open();
+    mt.saved_len = 0;
+    if (mt.fd >= 0)
+        mt.saved_len = blob_is_saved(blob) ? blob_length(blob) : (size_t) lseek(mt.fd, 0, SEEK_END);
+    saved_reset(blob_is_saved(blob));
+    pthread_mutex_unlock(&mt.lock);
+
+    mt.observer.changed = changed;
+    mt.observer.arg = blob;
+    blob_observe(blob, &mt.observer);
+
+    mt.nthreads = min(cpu_count(), MAX_THREADS);
+    for (unsigned i = 0; i < mt.nthreads; ++i)
+        thread_create_strict(&mt.threads[i], worker, NULL);
+}
+
+void merkle_stop(void)
+{
+    if (!mt.blob)
+        return;
+
+    pthread_mutex_lock(&mt.lock);
+    mt.stop = true;
+    pthread_cond_broadcast(&mt.cond);
+    pthread_mutex_unlock(&mt.lock);
+
+    for (unsigned i = 0; i < mt.nthreads; ++i)
+        pthread_join(mt.threads[i], NULL);
+
+    blob_unobserve(mt.blob, &mt.observer);
+    mt.blob = NULL;
+
+    for (unsigned k = 0; k < mt.levels; ++k)
+        free(mt.level[k]);
+    free(mt.dirty);
+    free(mt.saved);
+    free(mt.saved_state);
+    mt.level[0] = NULL;
+    mt.levels = 0;
+    mt.blocks = 0;
+    mt.dirty = NULL;
+    mt.saved = NULL;
+    mt.saved_state = NULL;
+    if (mt.fd >= 0 && close(mt.fd))
+        pdie("close");
+    mt.fd = -1;
+}
+
+bool merkle_running(struct blob const *blob)
+{
+    return mt.blob == blob;
+}
+
+/* the blob was just saved, maybe under a new name */
+void merkle_saved(struct blob const *blob)
+{
+    if (!merkle_running(blob))
+        return;
+
+    pthread_mutex_lock(&mt.lock);
+    while (mt.hashing)
+        pthread_cond_wait(&mt.idle, &mt.lock);
+    saved_open();
+    mt.saved_len = mt.len;
+    saved_reset(true);
+    pthread_mutex_unlock(&mt.lock);
+}
+
+/* until all hashes are there, calling progress (if given) every now and then */
+void merkle_wait(void (*progress)(void *arg, size_t done, size_t total), void *arg)
+{
+    struct timespec t;
+
+    pthread_mutex_lock(&mt.lock);
+    size_t total = mt.pending + mt.on_disk + mt.hashing;
+    while (!done()) {
+        if (clock_gettime(CLOCK_REALTIME, &t))
+            pdie("clock_gettime");
+        t.tv_nsec += 50000000;
+        t.tv_sec += t.tv_nsec / 1000000000;
+        t.tv_nsec %= 1000000000;
+        pthread_cond_timedwait(&mt.idle, &mt.lock, &t);
+        if (progress)
+            progress(arg, total - min(total, mt.pending + mt.on_disk + mt.hashing), total);
+    }
+    pthread_mutex_unlock(&mt.lock);
+}
+
+/* the root of the tree; call merkle_wait() first */
+void merkle_root(byte *digest)
+{
+    struct sha256 S;
+
+    pthread_mutex_lock(&mt.lock);
+    assert(done());
+    if (mt.blocks)
+        memcpy(digest, mt.level[mt.levels - 1][0].digest, SHA256_LEN);
+    else {
+        sha256_init(&S);
+        sha256_final(&S, digest);
+    }
+    pthread_mutex_unlock(&mt.lock);
+}
+
+/*
+ * A digest of [from, to): the nodes covering its whole blocks and the
+ * hashes of partial blocks at either end, hashed together in order, or
+ * just the digest if there is only one.  The whole blob gives the root,
+ * an empty range the hash of nothing.  Call merkle_wait() first.
+ */
+void merkle_range(size_t from, size_t to, byte *digest)
+{
+    byte piece[SHA256_LEN];
+    unsigned pieces = 0;
+    struct sha256 S;
+
+    pthread_mutex_lock(&mt.lock);
+    assert(done());
+    assert(to <= mt.len);
+
+    sha256_init(&S);
+    for (size_t end; from < to; from = end) {
+        size_t i = from / MERKLE_BLOCK;
+        end = min((i + 1) * MERKLE_BLOCK, mt.len);
+
+        if (from > i * MERKLE_BLOCK || end > to) {
+            end = min(end, to);
+            hash_part(from, end, piece);
+        }
+        else {
+            /* the largest node starting at block i that ends within the range */
+            unsigned k = 0;
+            while (k + 1 < mt.levels && !(i & (((size_t) 2 << k) - 1))
+                    && min((i + ((size_t) 2 << k)) * MERKLE_BLOCK, mt.len) <= to)
+                ++k;
+            memcpy(piece, mt.level[k][i >> k].digest, SHA256_LEN);
+            end = min((i + ((size_t) 1 << k)) * MERKLE_BLOCK, mt.len);
+        }
+
+        if (!pieces++) {
+            memcpy(digest, piece, SHA256_LEN);
+            continue;
+        }
+        if (pieces == 2)
+            sha256_update(&S, digest, SHA256_LEN);
+        sha256_update(&S, piece, SHA256_LEN);
+    }
+    if (pieces != 1)
+        sha256_final(&S, digest);
+
+    pthread_mutex_unlock(&mt.lock);
+}
+
+/* first position in [from, to) where the blob and the saved file differ, or -1 */
+static ssize_t compare(size_t from, size_t to)
+{
+    byte *a = malloc_strict(MERKLE_BLOCK), *b = malloc_strict(MERKLE_BLOCK);
+    ssize_t r = -1;
+
+    for (size_t n; r < 0 && from < to; from += n) {
+        n = min(to - from, MERKLE_BLOCK);
+        blob_read_strict(mt.blob, from, a, n);
+        n = read_saved(mt.fd, from, b, n);
+        for (size_t j = 0; j < n; ++j)
+            if (a[j] != b[j]) {
+                r = from + j;
+                break;
+            }
+    }
+
+    free(a);
+    free(b);
+    return r;
+}
+
+/*
+ * Whether [from, to) is the same as in the saved file, and if not, the
+ * first difference.  Past the end of the blob, to may be SIZE_MAX to
+ * include the end of both.  Call merkle_wait() first.
+ */
+enum merkle_same merkle_same(size_t from, size_t to, size_t *diff)
+{
+    enum merkle_same ret = MERKLE_SAME;
+    ssize_t r;
+
+    pthread_mutex_lock(&mt.lock);
+    assert(done());
+
+    if (mt.fd < 0) {
+        ret = MERKLE_NO_FILE;
+        goto out;
+    }
+
+    for (size_t i = from / MERKLE_BLOCK; i < mt.blocks && i * MERKLE_BLOCK < to; ++i) {
+        size_t start = i * MERKLE_BLOCK, end = min(start + MERKLE_BLOCK, mt.len);
+        size_t a = max(from, start), b = min(to, end);
+
+        if (i < mt.saved_blocks && mt.saved_state[i] == SAVED_AS_BLOB)
+            continue;
+
+        /* whole blocks with the same hash are the same; everything else gets compared */
+        if (i < mt.saved_blocks && a == start && b == end && end == min(start + MERKLE_BLOCK, mt.saved_len)
+                && !memcmp(mt.saved[i], mt.level[0][i].digest, SHA256_LEN))
+            continue;
+        if ((r = compare(a, min(b, max(a, mt.saved_len)))) >= 0) {
+            *diff = r;
+            ret = MERKLE_DIFFERENT;
+            goto out;
+        }
+        if (b > mt.saved_len) {
+            *diff = max(a, mt.saved_len);
+            ret = MERKLE_DIFFERENT;
+            goto out;
+        }
+    }
+
+    if (to > mt.len && mt.saved_len > mt.len) {
+        *diff = mt.len;
+        ret = MERKLE_DIFFERENT;
+    }
+
+out:
+    pthread_mutex_unlock(&mt.lock);
+    return ret;
+}
@@ -0,0 +1,37 @@
+#ifndef MERKLE_H
+#define MERKLE_H
+
+#include "common.h"
+
+struct blob;
+
+/*
+ * SHA-256 of every 64 KiB block of the blob, computed by background
+ * threads and kept up to date as the blob changes.  The block hashes are
+ * combined in a binary tree (a node hashes the digests of its two
+ * children; a lone child is passed up as it is), so the root is there
+ * again right after the changed blocks.  The block hashes of the file as
+ * last saved are kept as well, to tell which parts differ from it.
+ */
+
+#define MERKLE_BLOCK ((size_t) 1 << 16)
+
+enum merkle_same {
+    MERKLE_SAME,
+    MERKLE_DIFFERENT,
+    MERKLE_NO_FILE,
+};
+
+void merkle_start(struct blob *blob);
+void merkle_stop(void);
+bool merkle_running(struct blob const *blob);
+
+void merkle_saved(struct blob const *blob);
+
+void merkle_wait(void (*progress)(void *arg, size_t done, size_t total), void *arg);
+
+void merkle_root(byte *digest);
+void merkle_range(size_t from, size_t to, byte *digest);
+enum merkle_same merkle_same(size_t from, size_t to, size_t *diff);
+
+#endif
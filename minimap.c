@@ -0,0 +1,297 @@
+
+#define _GNU_SOURCE
+
+#include "minimap.h"
+
+#include "blob.h"
+#include "event.h"
+#include "histogram.h"
+
+#define MAX_BLOCKS 0x10000
+#define MIN_SHIFT 12 /* blocks of at least 4 KiB */
+#define MAX_THREADS 8
+
+/* minimum microseconds between redraws while computing */
+#define PROGRESS_INTERVAL 50000
+
+static struct {
+    struct blob *blob;
+    struct blob_observer observer;
+
+    pthread_t threads[MAX_THREADS];
+    unsigned nthreads;
+    bool stop;
+    unsigned users;  /* views showing the map */
+
+    /* everything below is protected by this */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+
+    size_t len;      /* of the blob, as far as the layout is concerned */
+    unsigned shift;  /* log2 of the block size */
+    size_t blocks;
+
+    /* level k sums up 2^k blocks per node */
+    unsigned levels;
+    struct minimap_summary *level[64];
+
+    uint8_t *dirty;  /* per block */
+    size_t pending;  /* dirty blocks */
+    size_t next;     /* where to look for dirty blocks */
+
+    uint64_t last_post;
+} mm = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+};
+
+static size_t level_size(unsigned k)
+{
+    return (mm.blocks + ((size_t) 1 << k) - 1) >> k;
+}
+
+static void add(struct minimap_summary *r, struct minimap_summary const *s)
+{
+    r->bytes += s->bytes;
+    r->zeros += s->zeros;
+    r->printable += s->printable;
+    r->entropy += s->entropy;
+    r->missing += s->missing;
+}
+
+/* recomputes the ancestors of block i */
+static void propagate(size_t i)
+{
+    for (unsigned k = 1; k < mm.levels; ++k) {
+        i /= 2;
+        struct minimap_summary *s = &mm.level[k][i];
+        memset(s, 0, sizeof(*s));
+        add(s, &mm.level[k - 1][2 * i]);
+        if (2 * i + 1 < level_size(k - 1))
+            add(s, &mm.level[k - 1][2 * i + 1]);
+    }
+}
+
+static void mark(size_t i)
+{
+    if (!mm.dirty[i]) {
+        mm.dirty[i] = 1;
+        ++mm.pending;
+    }
+}
+
+/* (re)allocates everything for a blob of length len, with all blocks missing */
+static void layout(size_t len)
+{
+    for (unsigned k = 0; k < mm.levels; ++k)
+        free(mm.level[k]);
+
+    mm.len = len;
+    for (mm.shift = MIN_SHIFT; (len >> mm.shift) >= MAX_BLOCKS; ++mm.shift);
+    mm.blocks = (len + ((size_t) 1 << mm.shift) - 1) >> mm.shift;
+    mm.levels = bit_length(max(mm.blocks, 1) - 1) + 1;
+
+    for (unsigned k = 0; k < mm.levels; ++k) {
+        size_t n = max(level_size(k), 1);
+        mm.level[k] = malloc_strict(n * sizeof(*mm.level[k]));
+        memset(mm.level[k], 0, n * sizeof(*mm.level[k]));
+    }
+
+    free(mm.dirty);
+    mm.dirty = malloc_strict(max(mm.blocks, 1));
+    memset(mm.dirty, 1, mm.blocks);
+    mm.pending = mm.blocks;
+    mm.next = 0;
+
+    for (size_t i = 0; i < mm.blocks; ++i)
+        mm.level[0][i].missing = 1;
+    for (unsigned k = 1; k < mm.levels; ++k)
+        for (size_t i = 0; i < level_size(k); ++i) {
+            add(&mm.level[k][i], &mm.level[k - 1][2 * i]);
+            if (2 * i + 1 < level_size(k - 1))
+                add(&mm.level[k][i], &mm.level[k - 1][2 * i + 1]);
+        }
+}
+
+/* called with the blob locked for writing */
+static void changed(void *arg, size_t pos, size_t old_len, size_t new_len)
+{
+    struct blob *blob = arg;
+    size_t len = blob_length(blob);
+    size_t to = old_len == new_len ? pos + new_len : len;
+
+    pthread_mutex_lock(&mm.lock);
+
+    if (len != mm.len) {
+        unsigned shift;
+        for (shift = MIN_SHIFT; (len >> shift) >= MAX_BLOCKS; ++shift);
+        if (shift != mm.shift || ((len + ((size_t) 1 << shift) - 1) >> shift) != mm.blocks) {
+            layout(len);
+            goto done;
+        }
+        mm.len = len;
+    }
+
+    /* a deletion at the end leaves nothing after pos, but shortens its block */
+    if (old_len != new_len && (pos >> mm.shift) < mm.blocks)
+        mark(pos >> mm.shift);
+
+    /* the contents of everything after an insertion or deletion moved */
+    if (to > pos)
+        for (size_t i = pos >> mm.shift; i <= (to - 1) >> mm.shift && i < mm.blocks; ++i)
+            mark(i);
+
+done:
+    pthread_cond_broadcast(&mm.cond);
+    pthread_mutex_unlock(&mm.lock);
+}
+
+/* called with the blob locked for reading */
+static void compute(size_t from, size_t to, struct minimap_summary *s)
+{
+    uint64_t hist[256] = {0};
+
+    histogram_count(mm.blob, from, to, hist);
+
+    memset(s, 0, sizeof(*s));
+    s->bytes = to - from;
+    s->zeros = hist[0];
+    for (unsigned b = 0x20; b < 0x7f; ++b)
+        s->printable += hist[b];
+    s->entropy = histogram_bits(hist, s->bytes);
+}
+
+static void *worker(void *arg)
+{
+    (void) arg;
+
+    while (true) {
+        struct minimap_summary s;
+        size_t i;
+        bool stop;
+
+        pthread_mutex_lock(&mm.lock);
+        while (!mm.pending && !mm.stop)
+            pthread_cond_wait(&mm.cond, &mm.lock);
+        stop = mm.stop;
+        pthread_mutex_unlock(&mm.lock);
+        if (stop)
+            break;
+
+        /* blocks can only move while we don't hold this */
+        pthread_rwlock_rdlock(&mm.blob->lock);
+
+        pthread_mutex_lock(&mm.lock);
+        for (i = 0; i < mm.blocks; ++i)
+            if (mm.dirty[(mm.next + i) % mm.blocks])
+                break;
+        if (i < mm.blocks) {
+            i = (mm.next + i) % mm.blocks;
+            mm.dirty[i] = 0;
+            --mm.pending;
+            mm.next = i + 1;
+        }
+        pthread_mutex_unlock(&mm.lock);
+
+        if (i < mm.blocks) {
+            compute(i << mm.shift, min(mm.len, (i + 1) << mm.shift), &s);
+
+            pthread_mutex_lock(&mm.lock);
+            mm.level[0][i] = s;
+            propagate(i);
+            uint64_t now = monotonic_microtime();
+            if (!mm.pending || now - mm.last_post >= PROGRESS_INTERVAL) {
+                mm.last_post = now;
+                event_post(EVENT_JOB);
+            }
+            pthread_mutex_unlock(&mm.lock);
+        }
+
+        pthread_rwlock_unlock(&mm.blob->lock);
+    }
+
+    return NULL;
+}
+
+/* for another view of the blob; false if the map is busy with another blob */
+bool minimap_start(struct blob *blob)
+{
+    if (mm.blob && mm.blob != blob)
+        return false;
+    if (mm.users++)
+        return true;
+
+    mm.blob = blob;
+    mm.stop = false;
+
+    pthread_mutex_lock(&mm.lock);
+    layout(blob_length(blob));
+    pthread_mutex_unlock(&mm.lock);
+
+    mm.observer.changed = changed;
+    mm.observer.arg = blob;
+    blob_observe(blob, &mm.observer);
+
+    mm.nthreads = min(cpu_count(), MAX_THREADS);
+    for (unsigned i = 0; i < mm.nthreads; ++i)
+        thread_create_strict(&mm.threads[i], worker, NULL);
+    return true;
+}
+
+void minimap_stop(void)
+{
+    if (!mm.blob)
+        return;
+
+    pthread_mutex_lock(&mm.lock);
+    mm.stop = true;
+    pthread_cond_broadcast(&mm.cond);
+    pthread_mutex_unlock(&mm.lock);
+
+    for (unsigned i = 0; i < mm.nthreads; ++i)
+        pthread_join(mm.threads[i], NULL);
+
+    blob_unobserve(mm.blob, &mm.observer);
+    mm.blob = NULL;
+    mm.users = 0;
+
+    for (unsigned k = 0; k < mm.levels; ++k)
+        free(mm.level[k]);
+    free(mm.dirty);
+    mm.levels = 0;
+    mm.dirty = NULL;
+}
+
+/* a view stopped showing the map; stops computing once none does */
+void minimap_release(void)
+{
+    if (mm.users && !--mm.users)
+        minimap_stop();
+}
+
+/* whether any view shows the map */
+bool minimap_shown(void)
+{
+    return mm.users;
+}
+
+/* sums up the blocks of blob overlapping [from, to) */
+void minimap_get(struct blob const *blob, size_t from, size_t to, struct minimap_summary *sum)
+{
+    memset(sum, 0, sizeof(*sum));
+
+    pthread_mutex_lock(&mm.lock);
+
+    if (mm.blob == blob && mm.blocks) {
+        size_t a = min(from >> mm.shift, mm.blocks - 1);
+        size_t b = min(max(to, from + 1) - 1, mm.len - 1) >> mm.shift;
+        for (unsigned k = 0, end = max(a, b) + 1; a < end; ++k, a >>= 1, end >>= 1) {
+            if (a & 1)
+                add(sum, &mm.level[k][a++]);
+            if (end & 1)
+                add(sum, &mm.level[k][--end]);
+        }
+    }
+
+    pthread_mutex_unlock(&mm.lock);
+}
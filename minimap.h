@@ -0,0 +1,29 @@
+#ifndef MINIMAP_H
+#define MINIMAP_H
+
+#include "common.h"
+
+struct blob;
+
+/*
+ * Per-block byte statistics for the whole blob, computed by background
+ * threads and kept up to date as the blob changes.  Blocks are summed up
+ * in a mipmap, so that any range can be summarized quickly.  There is
+ * one map, for one blob at a time.
+ */
+
+struct minimap_summary {
+    uint64_t bytes;  /* in blocks computed so far */
+    uint64_t zeros, printable;
+    double entropy;  /* in bits per byte, weighted by bytes */
+    size_t missing;  /* blocks not computed yet */
+};
+
+bool minimap_start(struct blob *blob);
+void minimap_stop(void);
+void minimap_release(void);
+bool minimap_shown(void);
+
+void minimap_get(struct blob const *blob, size_t from, size_t to, struct minimap_summary *sum);
+
+#endif
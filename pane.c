@@ -0,0 +1,288 @@
+
+#define _GNU_SOURCE
+
+#include "pane.h"
+
+#include "blob.h"
+#include "minimap.h"
+#include "screen.h"
+
+/* a pane, or two parts side by side or one above the other */
+struct node {
+    struct node *parent, *child[2];
+    bool side_by_side;
+    struct pane *pane;  /* leaves only */
+
+    /* stacked parts: the row between them */
+    unsigned sep_left, sep_top, sep_width;
+};
+
+static struct {
+    struct node *root;
+    struct pane *focus;
+    struct pane *closing;  /* freed once the input is done with it */
+    unsigned width, height;
+} panes;
+
+/* where a position ends up after old_len bytes at pos became new_len */
+static size_t moved(size_t x, size_t pos, size_t old_len, size_t new_len)
+{
+    if (x >= pos + old_len)
+        return x - old_len + new_len;
+    return min(x, pos + new_len);
+}
+
+/* another pane changed the blob */
+static void changed(void *arg, size_t pos, size_t old_len, size_t new_len)
+{
+    struct pane *P = arg;
+    struct input *I = &P->input;
+    size_t len = blob_length(P->view.blob);
+    size_t bound = len + (!len || (I->mode == INPUT && I->mode_insert));
+
+    if (P == panes.focus || old_len == new_len)
+        return;
+
+    I->cur = min(moved(I->cur, pos, old_len, new_len), bound - 1);
+    I->sel = min(moved(I->sel, pos, old_len, new_len), bound - 1);
+    view_recompute(&P->view, false);
+    view_adjust(&P->view);
+}
+
+static struct pane *pane_new(struct blob *blob)
+{
+    struct pane *P = malloc_strict(sizeof(*P));
+
+    view_init(&P->view, blob, &P->input);
+    input_init(&P->input, &P->view);
+
+    P->observer.changed = changed;
+    P->observer.arg = P;
+    blob_observe(blob, &P->observer);
+
+    return P;
+}
+
+static void pane_delete(struct pane *P)
+{
+    blob_unobserve(P->view.blob, &P->observer);
+    input_free(&P->input);
+    view_free(&P->view);
+    free(P);
+}
+
+static struct node *leaf(struct node *parent, struct pane *P)
+{
+    struct node *n = malloc_strict(sizeof(*n));
+    memset(n, 0, sizeof(*n));
+    n->parent = parent;
+    n->pane = P;
+    return n;
+}
+
+static struct node *find(struct node *n, struct pane const *P)
+{
+    struct node *r;
+    if (n->pane)
+        return n->pane == P ? n : NULL;
+    if ((r = find(n->child[0], P)))
+        return r;
+    return find(n->child[1], P);
+}
+
+/* the panes from left to right and top to bottom; just counts them without a list */
+static size_t leaves(struct node *n, struct pane **list, size_t count)
+{
+    if (n->pane) {
+        if (list)
+            list[count] = n->pane;
+        return count + 1;
+    }
+    count = leaves(n->child[0], list, count);
+    return leaves(n->child[1], list, count);
+}
+
+static void set_focus(struct pane *P)
+{
+    struct pane *F = panes.focus;
+
+    /* the cursor looks different without the keyboard */
+    if (F) {
+        F->view.inactive = true;
+        view_dirty_at(&F->view, F->input.cur);
+    }
+    P->view.inactive = false;
+    view_dirty_at(&P->view, P->input.cur);
+    panes.focus = P;
+}
+
+static void layout(struct node *n, unsigned left, unsigned top, unsigned width, unsigned height)
+{
+    if (n->pane) {
+        view_layout(&n->pane->view, left, top, width, height);
+        return;
+    }
+
+    if (n->side_by_side) {
+        layout(n->child[0], left, top, width / 2, height);
+        layout(n->child[1], left + width / 2, top, width - width / 2, height);
+    }
+    else {
+        unsigned h = height ? (height - 1) / 2 : 0;
+        n->sep_left = left;
+        n->sep_top = top + h;
+        n->sep_width = width;
+        layout(n->child[0], left, top, width, h);
+        layout(n->child[1], left, top + h + 1, width, height - min(height, h + 1));
+    }
+}
+
+struct pane *pane_open(struct blob *blob)
+{
+    struct pane *P = pane_new(blob);
+    panes.root = leaf(NULL, P);
+    set_focus(P);
+    return P;
+}
+
+struct pane *pane_focus(void)
+{
+    return panes.focus;
+}
+
+/* the focused pane gives half its room to a new one showing the same */
+bool pane_split(bool side_by_side)
+{
+    struct pane *F = panes.focus;
+    struct view const *V = &F->view;
+
+    if (side_by_side ? V->width / 2 < V->pos_digits + 2 * strlen(": ||")
+                     : V->height < 3)
+        return false;
+
+    struct pane *P = pane_new(V->blob);
+    P->view.start = V->start;
+    P->view.cols_fixed = V->cols_fixed;
+    P->view.cols = V->cols;
+    P->view.pos_digits = V->pos_digits;
+    P->view.color = V->color;
+    if ((P->view.map = V->map))
+        minimap_start(V->blob);
+    P->view.map_start = V->map_start;
+    P->view.map_len = V->map_len;
+    P->input.cur = F->input.cur;
+    P->input.mode_insert = F->input.mode_insert;
+    P->input.mode_ascii = F->input.mode_ascii;
+
+    struct node *n = find(panes.root, F);
+    n->child[0] = leaf(n, F);
+    n->child[1] = leaf(n, P);
+    n->side_by_side = side_by_side;
+    n->pane = NULL;
+
+    set_focus(P);
+    pane_layout(panes.width, panes.height);
+    return true;
+}
+
+/* closes the focused pane at the next pane_reap(), unless it's the only one */
+bool pane_close(void)
+{
+    if (panes.root->pane)
+        return false;
+    panes.closing = panes.focus;
+    return true;
+}
+
+void pane_cycle(int dir)
+{
+    size_t count = leaves(panes.root, NULL, 0), i;
+    struct pane **list = malloc_strict(count * sizeof(*list));
+
+    leaves(panes.root, list, 0);
+    for (i = 0; list[i] != panes.focus; ++i);
+    set_focus(list[(i + count + (dir > 0 ? 1 : -1)) % count]);
+    free(list);
+}
+
+void pane_reap(void)
+{
+    struct pane *P = panes.closing;
+
+    if (!P)
+        return;
+    panes.closing = NULL;
+
+    /* the other half takes the place of the split */
+    struct node *n = find(panes.root, P), *p = n->parent;
+    struct node *s = p->child[p->child[0] == n];
+    *p = (struct node) {.parent = p->parent};
+    p->pane = s->pane;
+    p->side_by_side = s->side_by_side;
+    for (size_t k = 0; k < 2; ++k)
+        if ((p->child[k] = s->child[k]))
+            p->child[k]->parent = p;
+    free(s);
+    free(n);
+
+    if (panes.focus == P) {
+        struct node *f = p;
+        while (!f->pane)
+            f = f->child[0];
+        panes.focus = NULL;
+        set_focus(f->pane);
+    }
+    pane_delete(P);
+
+    pane_layout(panes.width, panes.height);
+}
+
+void pane_layout(unsigned width, unsigned height)
+{
+    panes.width = width;
+    panes.height = height;
+    layout(panes.root, 0, 0, width, height);
+}
+
+static void update(struct node *n)
+{
+    if (n->pane) {
+        view_update(&n->pane->view);
+        return;
+    }
+
+    update(n->child[0]);
+    update(n->child[1]);
+
+    if (!n->side_by_side) {
+        struct cell line[max(n->sep_width, 1)];
+        for (unsigned j = 0; j < n->sep_width; ++j)
+            line[j] = (struct cell) {'-', 0};
+        screen_commit(n->sep_top, n->sep_left, line, n->sep_width);
+    }
+}
+
+/* draws all panes, as one frame */
+void pane_update(void)
+{
+    update(panes.root);
+    screen_flush();
+}
+
+static void free_node(struct node *n)
+{
+    if (n->pane)
+        pane_delete(n->pane);
+    else {
+        free_node(n->child[0]);
+        free_node(n->child[1]);
+    }
+    free(n);
+}
+
+void pane_free(void)
+{
+    free_node(panes.root);
+    memset(&panes, 0, sizeof(panes));
+    view_cache_free();
+}
@@ -0,0 +1,29 @@
+#ifndef PANE_H
+#define PANE_H
+
+#include "common.h"
+#include "view.h"
+#include "input.h"
+
+/* a view of a blob with a cursor of its own */
+struct pane {
+    struct view view;
+    struct input input;
+
+    /* keeps the cursor on its byte while other panes edit */
+    struct blob_observer observer;
+};
+
+struct pane *pane_open(struct blob *blob);
+struct pane *pane_focus(void);
+
+bool pane_split(bool side_by_side);
+bool pane_close(void);
+void pane_cycle(int dir);
+
+void pane_reap(void);
+void pane_layout(unsigned width, unsigned height);
+void pane_update(void);
+void pane_free(void);
+
+#endif
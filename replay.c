@@ -0,0 +1,156 @@
+
+#define _GNU_SOURCE
+
+#include "replay.h"
+
+#include <inttypes.h>
+
+struct replay replay;
+
+void replay_open(char const *filename)
+{
+    if (!(replay.in = fopen(filename, "r")))
+        pdie("could not open key script");
+}
+
+void record_open(char const *filename)
+{
+    if (!(replay.out = fopen(filename, "w")))
+        pdie("could not open key script");
+    replay.last = monotonic_microtime();
+}
+
+static void samples_free(struct samples *s)
+{
+    free(s->v);
+    memset(s, 0, sizeof(*s));
+}
+
+void replay_close(void)
+{
+    if (replay.in)
+        fclose(replay.in);
+    if (replay.out && fclose(replay.out))
+        pdie("could not write key script");
+    samples_free(&replay.key);
+    samples_free(&replay.render);
+    samples_free(&replay.flush);
+    samples_free(&replay.latency);
+    memset(&replay, 0, sizeof(replay));
+}
+
+static bool peek(void)
+{
+    uintmax_t delay, len;
+
+    if (replay.peeked)
+        return true;
+    if (replay.done)
+        return false;
+
+    if (2 != fscanf(replay.in, "%" SCNuMAX " %" SCNuMAX, &delay, &len) || fgetc(replay.in) != '\n') {
+        if (!feof(replay.in))
+            die("malformed key script");
+        replay.done = true;
+        return false;
+    }
+
+    replay.next_delay = delay;
+    replay.next_len = len;
+    return replay.peeked = true;
+}
+
+/* Returns the bytes of the next record, or nothing if the script is over
+ * or (for nonnegative timeouts) the record was read later than that. */
+size_t replay_read(byte *buf, size_t len, int64_t timeout)
+{
+    if (!peek())
+        return 0;
+    if (timeout >= 0 && replay.next_delay >= (uint64_t) timeout)
+        return 0;
+
+    len = min(len, replay.next_len);
+    if (len != fread(buf, 1, len, replay.in))
+        die("truncated key script");
+
+    /* long records are split; the rest follows immediately */
+    if ((replay.next_len -= len)) {
+        replay.next_delay = 0;
+    }
+    else {
+        replay.peeked = false;
+        if (fgetc(replay.in) != '\n')
+            die("malformed key script");
+    }
+
+    return len;
+}
+
+void record_write(byte const *buf, size_t len)
+{
+    uint64_t now = monotonic_microtime();
+
+    fprintf(replay.out, "%" PRIu64 " %zu\n", now - replay.last, len);
+    fwrite(buf, 1, len, replay.out);
+    fputc('\n', replay.out);
+    replay.last = now;
+}
+
+
+static void sample(struct samples *s, uint64_t v)
+{
+    if (s->n == s->cap)
+        s->v = realloc_strict(s->v, (s->cap = max(2 * s->cap, 0x100)) * sizeof(*s->v));
+    s->v[s->n++] = v;
+}
+
+void replay_key(uint64_t us)
+{
+    sample(&replay.key, us);
+}
+
+void replay_frame(uint64_t render, uint64_t flush)
+{
+    uint64_t now = monotonic_microtime();
+
+    sample(&replay.render, render - flush);
+    sample(&replay.flush, flush);
+    if (replay.arrival) {
+        sample(&replay.latency, now - replay.arrival);
+        replay.arrival = 0;
+    }
+}
+
+static int cmp_u64(void const *a, void const *b)
+{
+    uint64_t x = *(uint64_t const *) a, y = *(uint64_t const *) b;
+    return (x > y) - (x < y);
+}
+
+static void summarize(FILE *fp, char const *name, struct samples *s)
+{
+    uint64_t sum = 0;
+
+    if (!s->n) {
+        fprintf(fp, "%-8s %8u\n", name, 0);
+        return;
+    }
+
+    qsort(s->v, s->n, sizeof(*s->v), cmp_u64);
+    for (size_t i = 0; i < s->n; ++i)
+        sum += s->v[i];
+
+    fprintf(fp, "%-8s %8zu %10.1f %8" PRIu64 " %8" PRIu64 " %8" PRIu64 " %8" PRIu64 "\n",
+            name, s->n, (double) sum / s->n,
+            s->v[s->n / 2], s->v[s->n * 9 / 10], s->v[s->n * 99 / 100], s->v[s->n - 1]);
+}
+
+/* all times in microseconds */
+void replay_summary(FILE *fp)
+{
+    fprintf(fp, "%-8s %8s %10s %8s %8s %8s %8s\n", "", "count", "avg", "p50", "p90", "p99", "max");
+    summarize(fp, "key", &replay.key);
+    summarize(fp, "render", &replay.render);
+    summarize(fp, "flush", &replay.flush);
+    summarize(fp, "latency", &replay.latency);
+}
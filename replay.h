@@ -0,0 +1,46 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include "common.h"
+
+/*
+ * Key scripts contain everything read from the terminal, one record per
+ * read(): "<microseconds since the previous record> <length>\n", followed
+ * by that many raw bytes and a newline.
+ */
+
+struct samples {
+    uint64_t *v;
+    size_t n, cap;
+};
+
+struct replay {
+    FILE *in, *out;
+    bool done;  /* script exhausted */
+
+    bool peeked;
+    uint64_t next_delay;
+    size_t next_len;
+
+    uint64_t last;     /* time of the previous recorded read */
+    uint64_t arrival;  /* time the keys being handled became available */
+
+    struct samples key, render, flush, latency;
+};
+
+extern struct replay replay;
+
+void replay_open(char const *filename);
+void record_open(char const *filename);
+void replay_close(void);
+
+static inline bool replay_active(void) { return replay.in || replay.out; }
+
+size_t replay_read(byte *buf, size_t len, int64_t timeout);
+void record_write(byte const *buf, size_t len);
+
+void replay_key(uint64_t us);
+void replay_frame(uint64_t render, uint64_t flush);
+void replay_summary(FILE *fp);
+
+#endif
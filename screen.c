@@ -0,0 +1,286 @@
+
+#define _GNU_SOURCE
+
+#include "screen.h"
+
+#include <stdarg.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "ansi.h"
+#include "term.h"
+
+struct screen screen;
+
+void screen_init(void)
+{
+    memset(&screen, 0, sizeof(screen));
+    screen.sync = !term.is_basic;
+    screen_grow(0x10000); /* enough for most frames */
+}
+
+void screen_free(void)
+{
+    free(screen.buf);
+    free(screen.shadow);
+}
+
+void screen_grow(size_t len)
+{
+    while (screen.cap - screen.len < len)
+        screen.cap = max(2 * screen.cap, 0x1000);
+    screen.buf = realloc_strict(screen.buf, screen.cap);
+}
+
+void screen_printf(char const *fmt, ...)
+{
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(screen.buf + screen.len, screen.cap - screen.len, fmt, ap);
+    va_end(ap);
+    if (n < 0)
+        pdie("vsnprintf");
+
+    if ((size_t) n >= screen.cap - screen.len) {
+        screen_grow(n + 1);
+        va_start(ap, fmt);
+        vsnprintf(screen.buf + screen.len, screen.cap - screen.len, fmt, ap);
+        va_end(ap);
+    }
+    screen.len += n;
+}
+
+
+/*
+ * Differential output: rows are committed as cells and compared against a
+ * shadow copy of what the terminal shows.  Only changed cells are sent,
+ * unless redrawing the whole row turns out to be shorter.
+ */
+
+void screen_resize(unsigned width, unsigned height)
+{
+    screen.width = width;
+    screen.height = height;
+    screen.shadow = realloc_strict(screen.shadow, (size_t) width * height * sizeof(*screen.shadow));
+    for (unsigned r = 0; r < height; ++r)
+        screen_invalidate(r);
+}
+
+/* for rows that were printed to directly */
+void screen_invalidate(unsigned row)
+{
+    if (row < screen.height)
+        memset(screen.shadow + (size_t) row * screen.width, 0, screen.width * sizeof(*screen.shadow));
+}
+
+void screen_clear(void)
+{
+    screen_puts(clear_screen);
+    for (size_t i = 0; i < (size_t) screen.width * screen.height; ++i)
+        screen.shadow[i] = blank_cell;
+}
+
+void screen_scroll(signed amount)
+{
+    size_t w = screen.width, h = screen.height, n = min(abs(amount), h);
+
+    screen_printf("\x1b[%u%c", abs(amount), amount > 0 ? 'S' : 'T');
+
+    if (amount > 0)
+        memmove(screen.shadow, screen.shadow + n * w, (h - n) * w * sizeof(*screen.shadow));
+    else
+        memmove(screen.shadow + n * w, screen.shadow, (h - n) * w * sizeof(*screen.shadow));
+    for (size_t i = 0; i < n * w; ++i)
+        screen.shadow[(amount > 0 ? (h - n) * w : 0) + i] = blank_cell;
+}
+
+static inline bool cell_blank(struct cell c)
+{
+    return c.glyph == ' ' && !(c.attr & (ATTR_UNDERLINE | ATTR_INVERSE));
+}
+
+static inline bool cell_eq(struct cell a, struct cell b)
+{
+    if (cell_blank(a) && cell_blank(b))
+        return true;
+    return a.glyph == b.glyph && a.attr == b.attr;
+}
+
+static void set_attr(uint8_t attr)
+{
+    char buf[0x20], *p = buf;
+    uint8_t old = screen.attr;
+
+    if (screen.attr_known && attr == old)
+        return;
+    if (!screen.attr_known)
+        p += sprintf(p, ";0"), old = 0;
+
+    if ((old ^ attr) & ATTR_BOLD)
+        p += sprintf(p, attr & ATTR_BOLD ? ";1" : ";22");
+    if ((old ^ attr) & ATTR_UNDERLINE)
+        p += sprintf(p, attr & ATTR_UNDERLINE ? ";4" : ";24");
+    if ((old ^ attr) & ATTR_INVERSE)
+        p += sprintf(p, attr & ATTR_INVERSE ? ";7" : ";27");
+    if ((old ^ attr) & ATTR_COLOR)
+        p += sprintf(p, ";%u", attr & ATTR_COLOR ? 29 + (attr & ATTR_COLOR) : 39);
+
+    screen_printf("\x1b[%sm", buf + 1);
+    screen.attr = attr;
+    screen.attr_known = true;
+}
+
+static void put_cells(struct cell const *cells, unsigned n)
+{
+    for (unsigned i = 0; i < n; ++i) {
+        if (!cell_blank(cells[i]) || (screen.attr & (ATTR_UNDERLINE | ATTR_INVERSE)))
+            set_attr(cells[i].attr);
+        screen_putc(cells[i].glyph);
+    }
+}
+
+/* erases n cells from the cursor */
+static void erase(unsigned col, unsigned n)
+{
+    if (screen.attr & (ATTR_UNDERLINE | ATTR_INVERSE))
+        set_attr(0);
+    if (col + n >= screen.width)
+        screen_puts(clear_line);
+    else
+        screen_printf("\x1b[%uX", n);
+}
+
+/* the number of cells after which everything is blank */
+static unsigned used(struct cell const *cells, unsigned n)
+{
+    while (n && cell_blank(cells[n - 1]))
+        --n;
+    return n;
+}
+
+static void commit_full(unsigned row, unsigned col, struct cell const *cells, unsigned n)
+{
+    unsigned u = used(cells, n);
+    screen_printf("\x1b[%u;%uH", row + 1, col + 1);
+    put_cells(cells, u);
+    if (u < n)
+        erase(col + u, n - u);
+}
+
+static void commit_diff(unsigned row, unsigned col, struct cell const *cells, unsigned n)
+{
+    struct cell const *old = screen.shadow + (size_t) row * screen.width + col;
+    unsigned const gap = 8; /* cheaper to resend than to move the cursor */
+    unsigned u = used(cells, n);
+
+    for (unsigned j = 0, k, x = -1u; j < u; j = k) {
+        if (cell_eq(cells[j], old[j])) {
+            k = j + 1;
+            continue;
+        }
+
+        /* extend the run over short stretches of unchanged cells */
+        for (k = j + 1; k < u; ++k) {
+            unsigned d = k;
+            while (d < u && d - k < gap && cell_eq(cells[d], old[d]))
+                ++d;
+            if (d >= u || d - k >= gap)
+                break;
+            k = d;
+        }
+
+        if (x != j)
+            screen_printf("\x1b[%u;%uH", row + 1, col + j + 1);
+        put_cells(cells + j, k - j);
+        x = k;
+    }
+
+    for (unsigned j = u; j < n; ++j) {
+        if (!old[j].glyph || !cell_blank(old[j])) {
+            screen_printf("\x1b[%u;%uH", row + 1, col + u + 1);
+            erase(col + u, n - u);
+            break;
+        }
+    }
+}
+
+void screen_commit(unsigned row, unsigned col, struct cell const *cells, unsigned n)
+{
+    if (row >= screen.height || col >= screen.width)
+        return;
+    n = min(n, screen.width - col);
+
+    uint8_t const attr = screen.attr;
+    bool const attr_known = screen.attr_known;
+    size_t const mark = screen.len;
+
+    commit_diff(row, col, cells, n);
+
+    size_t const diff_len = screen.len - mark;
+    uint8_t const diff_attr = screen.attr;
+    bool const diff_attr_known = screen.attr_known;
+
+    if (diff_len) {
+        screen.attr = attr;
+        screen.attr_known = attr_known;
+        commit_full(row, col, cells, n);
+
+        if (screen.len - (mark + diff_len) < diff_len) {
+            memmove(screen.buf + mark, screen.buf + mark + diff_len, screen.len - (mark + diff_len));
+            screen.len -= diff_len;
+        }
+        else {
+            screen.len = mark + diff_len;
+            screen.attr = diff_attr;
+            screen.attr_known = diff_attr_known;
+        }
+    }
+
+    memcpy(screen.shadow + (size_t) row * screen.width + col, cells, n * sizeof(*cells));
+}
+
+void screen_flush(void)
+{
+    struct iovec iov[3] = {
+        {(void *) sync_update_on, strlen(sync_update_on)},
+        {screen.buf, screen.len},
+        {(void *) sync_update_off, strlen(sync_update_off)},
+    };
+    struct iovec *v = screen.sync ? iov : iov + 1;
+    int cnt = screen.sync ? 3 : 1;
+
+    uint64_t t;
+
+    if (!screen.len) {
+        screen.flush_time = 0;
+        return;
+    }
+
+    t = monotonic_microtime();
+    fflush(stdout); /* anything printed directly must come first */
+
+    while (cnt) {
+        ssize_t r = writev(fileno(stdout), v, cnt);
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+            pdie("writev");
+        }
+        for (; cnt && (size_t) r >= v->iov_len; --cnt, ++v)
+            r -= v->iov_len;
+        if (cnt) {
+            v->iov_base = (char *) v->iov_base + r;
+            v->iov_len -= r;
+        }
+    }
+
+    screen.frame_bytes = screen.len + (screen.sync ? strlen(sync_update_on) + strlen(sync_update_off) : 0);
+    screen.total_bytes += screen.frame_bytes;
+    screen.flush_time = monotonic_microtime() - t;
+
+    screen.len = 0;
+    screen.attr_known = false; /* others may print in between frames */
+}
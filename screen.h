@@ -0,0 +1,73 @@
+#ifndef SCREEN_H
+#define SCREEN_H
+
+#include "common.h"
+
+enum {
+    ATTR_COLOR     = 0x0f,  /* enum color */
+    ATTR_BOLD      = 0x10,
+    ATTR_UNDERLINE = 0x20,
+    ATTR_INVERSE   = 0x40,
+};
+
+struct cell {
+    char glyph;  /* zero if unknown */
+    uint8_t attr;
+};
+
+static const struct cell blank_cell = {' ', 0};
+
+struct screen {
+    /* the next frame, written to the terminal in one go by screen_flush() */
+    char *buf;
+    size_t len, cap;
+
+    bool sync;  /* wrap frames in synchronized-update escapes */
+
+    /* what the terminal currently shows, as far as we know */
+    unsigned width, height;
+    struct cell *shadow;
+
+    uint8_t attr;  /* current attributes... */
+    bool attr_known;  /* ...if these are known */
+
+    size_t frame_bytes, total_bytes;  /* written to the terminal */
+    uint64_t flush_time;  /* microseconds spent writing the last frame */
+};
+
+extern struct screen screen;  /* screen.c */
+
+void screen_init(void);
+void screen_free(void);
+
+void screen_grow(size_t len);
+
+static inline void screen_put(char const *s, size_t len)
+{
+    if (screen.cap - screen.len < len)
+        screen_grow(len);
+    memcpy(screen.buf + screen.len, s, len);
+    screen.len += len;
+}
+
+static inline void screen_puts(char const *s) { screen_put(s, strlen(s)); }
+static inline void screen_putc(char c) { screen_put(&c, 1); }
+
+void screen_printf(char const *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+void screen_resize(unsigned width, unsigned height);
+void screen_invalidate(unsigned row);
+void screen_clear(void);
+void screen_scroll(signed amount);
+void screen_commit(unsigned row, unsigned col, struct cell const *cells, unsigned n);
+
+/* false if the cell was invalidated or never drawn */
+static inline bool screen_known(unsigned row, unsigned col)
+{
+    return row >= screen.height || col >= screen.width
+        || screen.shadow[(size_t) row * screen.width + col].glyph;
+}
+
+void screen_flush(void);
+
+#endif
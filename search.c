@@ -0,0 +1,826 @@
+
+#define _GNU_SOURCE
+
+#include "search.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <float.h>
+#include <math.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "blob.h"
+#include "trace.h"
+
+void search_init(struct search *search)
+{
+    memset(search, 0, sizeof(*search));
+}
+
+void search_free(struct search *search)
+{
+    free(search->needle);
+    search_init(search);
+}
+
+
+/*
+ * Typed values: "i32", "u16be", "f64le", ... Without an explicit byte
+ * order, both little and big endian encodings are searched for at once.
+ */
+
+static bool parse_type(struct search *search, char const *type)
+{
+    char *p;
+
+    switch (*type) {
+    case 'i': case 'u': break;
+    case 'f': search->value.is_float = true; break;
+    default: return false;
+    }
+
+    errno = 0;
+    unsigned long bits = strtoul(type + 1, &p, 10);
+    if (errno || p == type + 1)
+        return false;
+    if (bits != 8 && bits != 16 && bits != 32 && bits != 64)
+        return false;
+    if (search->value.is_float && bits != 32 && bits != 64)
+        return false;
+    search->len = bits / 8;
+
+    if (!*p)
+        search->value.little = search->value.big = true;
+    else if (!strcmp(p, "le"))
+        search->value.little = true;
+    else if (!strcmp(p, "be"))
+        search->value.big = true;
+    else
+        return false;
+
+    return true;
+}
+
+static bool parse_int(struct search const *search, bool is_signed, char const *val, uint64_t *bits)
+{
+    char *p;
+    unsigned n = 8 * search->len;
+
+    errno = 0;
+    if (is_signed) {
+        long long v = strtoll(val, &p, 0);
+        if (errno || *p || p == val)
+            return false;
+        if (n < 64 && (v < -(1ll << (n - 1)) || v >= (1ll << (n - 1))))
+            return false;
+        *bits = v;
+    }
+    else {
+        if (*val == '-')
+            return false;
+        unsigned long long v = strtoull(val, &p, 0);
+        if (errno || *p || p == val)
+            return false;
+        if (n < 64 && v >> n)
+            return false;
+        *bits = v;
+    }
+
+    if (n < 64)
+        *bits &= ((uint64_t) 1 << n) - 1;
+    return true;
+}
+
+static bool parse_float(struct search *search, char const *val, char const *tol, uint64_t *bits)
+{
+    char *p;
+
+    errno = 0;
+    search->value.val = strtod(val, &p);
+    if (errno || *p || p == val || !isfinite(search->value.val))
+        return false;
+
+    if (tol) {
+        search->value.tol = strtod(tol, &p);
+        if (errno || *p || p == tol || !(search->value.tol >= 0))
+            return false;
+    }
+
+    if (search->len == 4) {
+        float f = search->value.val;
+        uint32_t u;
+        memcpy(&u, &f, sizeof(u));
+        *bits = u;
+        search->value.val = f; /* compare against what is representable */
+    }
+    else {
+        memcpy(bits, &search->value.val, sizeof(*bits));
+    }
+    return true;
+}
+
+bool search_value(struct search *search, char const *type, char const *val, char const *tol)
+{
+    uint64_t bits;
+
+    search_free(search);
+    search->type = SEARCH_VALUE;
+
+    if (!type || !val || !parse_type(search, type))
+        goto bad;
+
+    if (search->value.is_float) {
+        if (!parse_float(search, val, tol, &bits))
+            goto bad;
+    }
+    else {
+        if (tol || !parse_int(search, *type == 'i', val, &bits))
+            goto bad;
+    }
+
+    /* little endian encoding, followed by big endian encoding */
+    search->needle = malloc_strict(2 * search->len);
+    for (size_t i = 0; i < search->len; ++i) {
+        search->needle[i] = bits >> 8 * i;
+        search->needle[search->len + i] = bits >> 8 * (search->len - 1 - i);
+    }
+
+    return true;
+
+bad:
+    search_free(search);
+    return false;
+}
+
+
+/*
+ * Case-insensitive needles store the lowercase needle, followed by a mask
+ * of 0x20 bits to be or-ed into each haystack byte before comparing.  Only
+ * ASCII letters are folded; for UCS-2, only those with a zero high byte.
+ */
+
+static inline bool is_letter(byte c)
+{
+    return (c | 0x20) >= 'a' && (c | 0x20) <= 'z';
+}
+
+void search_nocase(struct search *search, byte const *needle, size_t len, size_t stride)
+{
+    assert(stride == 1 || stride == 2);
+
+    search_free(search);
+    if (!len)
+        return;
+
+    search->type = SEARCH_NOCASE;
+    search->len = len;
+    search->needle = malloc_strict(2 * len);
+
+    for (size_t i = 0; i < len; ++i) {
+        bool fold = !(i % stride) && is_letter(needle[i])
+                 && (stride == 1 || (i + 1 < len && !needle[i + 1]));
+        search->needle[len + i] = fold ? 0x20 : 0;
+        search->needle[i] = needle[i] | search->needle[len + i];
+    }
+}
+
+
+/*
+ * Approximate needles match wherever at most approx.max bytes (or bits)
+ * differ from the needle.
+ */
+
+bool search_approx(struct search *search, byte const *needle, size_t len, size_t max, bool bits)
+{
+    search_free(search);
+    if (!len || max >= (bits ? 8 : 1) * len)
+        return false;
+
+    search->type = SEARCH_APPROX;
+    search->len = len;
+    search->needle = malloc_strict(len);
+    memcpy(search->needle, needle, len);
+    search->approx.max = max;
+    search->approx.bits = bits;
+    return true;
+}
+
+/* stops counting as soon as limit is exceeded */
+static size_t distance(struct search const *S, byte const *p, size_t limit)
+{
+    static const uint64_t ones = 0x0101010101010101;
+    byte const *n = S->needle;
+    size_t d = 0, j = 0;
+
+    for (; j + 8 <= S->len && d <= limit; j += 8) {
+        uint64_t x, y;
+        memcpy(&x, p + j, sizeof(x));
+        memcpy(&y, n + j, sizeof(y));
+        x ^= y;
+        if (!S->approx.bits) {
+            x |= x >> 4, x |= x >> 2, x |= x >> 1;
+            x &= ones;
+        }
+        d += __builtin_popcountll(x);
+    }
+    for (; j < S->len && d <= limit; ++j)
+        d += S->approx.bits ? (size_t) __builtin_popcount(p[j] ^ n[j]) : p[j] != n[j];
+
+    return d;
+}
+
+size_t search_distance(struct search const *search, struct blob const *blob, size_t pos)
+{
+    assert(search->type == SEARCH_APPROX);
+    assert(pos + search->len <= blob_length(blob));
+
+    byte *buf = malloc_strict(search->len);
+    blob_read_strict(blob, pos, buf, search->len);
+    size_t d = distance(search, buf, SIZE_MAX);
+    free(buf);
+    return d;
+}
+
+
+/*
+ * Generic scanner: finds the first window of a fixed length in a range of
+ * positions for which a predicate holds.  Where the predicate implies fixed
+ * first and last bytes, candidates are filtered sixteen positions at a time
+ * (SSE2) before the predicate is evaluated; other matchers may supply their
+ * own sixteen-position kernel.
+ */
+
+#define SCAN_CHUNK ((size_t) 1 << 16)
+#define MAX_ALTS 2
+
+struct matcher {
+    struct search const *search;
+    size_t len;  /* window length */
+
+    unsigned alts;  /* number of (first, last) byte pairs; 0 disables filter */
+    struct {
+        byte first, last;
+        byte first_fold, last_fold;  /* or-ed into the haystack byte first */
+    } alt[MAX_ALTS];
+
+    bool (*verify)(struct matcher *, byte const *);
+
+    /* bit i set iff position p+i is a candidate; reads p[0..len+14] */
+    unsigned (*block)(struct matcher const *, byte const *p);
+
+    /* values within a tolerance: ranges their top two bytes must lie in */
+    unsigned ranges;
+    struct {
+        size_t top, next;  /* offsets of those bytes in the window */
+        byte top_min, top_max, next_min, next_max;
+    } range[2 * MAX_ALTS];
+
+    byte *buf;  /* scratch space for windows crossing span boundaries */
+};
+
+static inline bool prefilter(struct matcher const *M, byte const *p)
+{
+    if (!M->alts)
+        return true;
+    for (unsigned a = 0; a < M->alts; ++a)
+        if ((p[0] | M->alt[a].first_fold) == M->alt[a].first
+                && (p[M->len - 1] | M->alt[a].last_fold) == M->alt[a].last)
+            return true;
+    return false;
+}
+
+#ifdef __SSE2__
+static unsigned candidates(struct matcher const *M, byte const *p)
+{
+    __m128i a = _mm_loadu_si128((__m128i const *) p);
+    __m128i b = _mm_loadu_si128((__m128i const *) (p + M->len - 1));
+    __m128i m = _mm_setzero_si128();
+    for (unsigned i = 0; i < M->alts; ++i) {
+        __m128i f = _mm_or_si128(a, _mm_set1_epi8(M->alt[i].first_fold));
+        __m128i l = _mm_or_si128(b, _mm_set1_epi8(M->alt[i].last_fold));
+        f = _mm_cmpeq_epi8(f, _mm_set1_epi8(M->alt[i].first));
+        l = _mm_cmpeq_epi8(l, _mm_set1_epi8(M->alt[i].last));
+        m = _mm_or_si128(m, _mm_and_si128(f, l));
+    }
+    return _mm_movemask_epi8(m);
+}
+
+/*
+ * Sixteen window positions at once: one byte lane of saturating mismatch
+ * counters per position, one needle byte per step.  Bails out early when
+ * all positions exceed the distance bound.
+ */
+static unsigned approx_block(struct matcher const *M, byte const *p)
+{
+    struct search const *S = M->search;
+    __m128i const bound = _mm_set1_epi8(S->approx.max + 1);
+    __m128i const low = _mm_set1_epi8(0x01);
+    __m128i d = _mm_setzero_si128();
+
+    for (size_t j = 0; j < S->len; ++j) {
+        __m128i x = _mm_loadu_si128((__m128i const *) (p + j));
+        x = _mm_xor_si128(x, _mm_set1_epi8(S->needle[j]));
+        if (S->approx.bits) {
+            /* per-byte population count */
+            x = _mm_sub_epi8(x, _mm_and_si128(_mm_srli_epi16(x, 1), _mm_set1_epi8(0x55)));
+            x = _mm_add_epi8(_mm_and_si128(x, _mm_set1_epi8(0x33)),
+                             _mm_and_si128(_mm_srli_epi16(x, 2), _mm_set1_epi8(0x33)));
+            x = _mm_and_si128(_mm_add_epi8(x, _mm_srli_epi16(x, 4)), _mm_set1_epi8(0x0f));
+        }
+        else {
+            x = _mm_andnot_si128(_mm_cmpeq_epi8(x, _mm_setzero_si128()), low);
+        }
+        d = _mm_adds_epu8(d, x);
+
+        if (j % 8 == 7 && _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(d, bound), bound)) == 0xffff)
+            return 0;
+    }
+
+    /* lanes with d <= max */
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(d, bound), d))
+         & ~_mm_movemask_epi8(_mm_cmpeq_epi8(d, bound));
+}
+
+/* lanes with lo <= x <= hi */
+static __m128i in_range(__m128i x, byte lo, byte hi)
+{
+    __m128i below = _mm_subs_epu8(_mm_set1_epi8(lo), x);
+    __m128i above = _mm_subs_epu8(x, _mm_set1_epi8(hi));
+    return _mm_cmpeq_epi8(_mm_or_si128(below, above), _mm_setzero_si128());
+}
+
+static unsigned range_block(struct matcher const *M, byte const *p)
+{
+    __m128i m = _mm_setzero_si128();
+    for (unsigned i = 0; i < M->ranges; ++i) {
+        __m128i t = _mm_loadu_si128((__m128i const *) (p + M->range[i].top));
+        __m128i n = _mm_loadu_si128((__m128i const *) (p + M->range[i].next));
+        m = _mm_or_si128(m, _mm_and_si128(in_range(t, M->range[i].top_min, M->range[i].top_max),
+                                          in_range(n, M->range[i].next_min, M->range[i].next_max)));
+    }
+    return _mm_movemask_epi8(m);
+}
+#endif
+
+/* windows p[j..j+len) for 0 <= j < cnt are all readable */
+static ssize_t scan_span(struct matcher *M, byte const *p, size_t cnt, ssize_t dir)
+{
+    if (dir > 0) {
+        size_t j = 0;
+#ifdef __SSE2__
+        if (M->block)
+            for (; j + 16 <= cnt; j += 16)
+                for (unsigned m = M->block(M, p + j); m; m &= m - 1)
+                    if (M->verify(M, p + j + __builtin_ctz(m)))
+                        return j + __builtin_ctz(m);
+#endif
+        for (; j < cnt; ++j)
+            if (prefilter(M, p + j) && M->verify(M, p + j))
+                return j;
+    }
+    else {
+        size_t j = cnt;
+#ifdef __SSE2__
+        if (M->block)
+            for (; j >= 16; j -= 16)
+                for (unsigned m = M->block(M, p + j - 16), b; m; m &= ~(1u << b))
+                    if (M->verify(M, p + j - 16 + (b = 31 - __builtin_clz(m))))
+                        return j - 16 + b;
+#endif
+        while (j--)
+            if (prefilter(M, p + j) && M->verify(M, p + j))
+                return j;
+    }
+    return -1;
+}
+
+/* first match among window positions [lo, hi) in direction dir */
+static ssize_t scan(struct matcher *M, struct blob const *blob, size_t lo, size_t hi, ssize_t dir)
+{
+    assert(hi <= blob_length(blob) - M->len + 1);
+
+    while (lo < hi) {
+        size_t q = dir > 0 ? lo : hi - 1, from, to, s, n;
+        byte const *p;
+        ssize_t r;
+
+        /* windows inside a hole are all zeros: try one of them */
+        if (blob_hole(blob, q, &from, &to) && to - q >= M->len) {
+            memset(M->buf, 0, M->len);
+            if (prefilter(M, M->buf) && M->verify(M, M->buf))
+                return q;
+            if (dir > 0)
+                lo = min(hi, to - M->len + 1);
+            else
+                hi = max(lo, from);
+            continue;
+        }
+
+        if (dir > 0) {
+            p = blob_lookup(blob, s = lo, &n);
+            if (n >= M->len) {
+                size_t cnt = min(min(hi - s, SCAN_CHUNK), n - M->len + 1);
+                if ((r = scan_span(M, p, cnt, dir)) >= 0)
+                    return s + r;
+                lo = s + cnt;
+                continue;
+            }
+        }
+        else {
+            /* the span holding the last window position */
+            s = hi - min(hi - lo, SCAN_CHUNK);
+            for (p = blob_lookup(blob, s, &n); s + n < hi; p = blob_lookup(blob, s += n, &n));
+            if (s + n >= hi - 1 + M->len) {
+                if ((r = scan_span(M, p, hi - s, dir)) >= 0)
+                    return s + r;
+                hi = s;
+                continue;
+            }
+        }
+
+        /* this window crosses a span boundary: go slowly */
+        blob_read_strict(blob, q, M->buf, M->len);
+        if (prefilter(M, M->buf) && M->verify(M, M->buf))
+            return q;
+        if (dir > 0)
+            ++lo;
+        else
+            --hi;
+    }
+
+    return -1;
+}
+
+/* like blob_search(): start at start, wrap around at the end */
+static ssize_t scan_wrap(struct matcher *M, struct blob const *blob, size_t start, ssize_t dir)
+{
+    size_t blen = blob_length(blob);
+    ssize_t r;
+
+    if (!M->len || M->len > blen)
+        return -1;
+
+    size_t n = blen - M->len + 1; /* number of window positions */
+
+    M->buf = malloc_strict(M->len);
+    if (dir > 0) {
+        if ((r = scan(M, blob, min(start, n), n, dir)) < 0)
+            r = scan(M, blob, 0, min(start, n), dir);
+    }
+    else {
+        if ((r = scan(M, blob, 0, min(start + 1, n), dir)) < 0)
+            r = scan(M, blob, min(start + 1, n), n, dir);
+    }
+    free(M->buf);
+
+    return r;
+}
+
+
+static bool verify_nocase(struct matcher *M, byte const *p)
+{
+    byte const *n = M->search->needle, *f = n + M->len;
+    size_t j = 0;
+#ifdef __SSE2__
+    for (; j + 16 <= M->len; j += 16) {
+        __m128i h = _mm_loadu_si128((__m128i const *) (p + j));
+        h = _mm_or_si128(h, _mm_loadu_si128((__m128i const *) (f + j)));
+        h = _mm_cmpeq_epi8(h, _mm_loadu_si128((__m128i const *) (n + j)));
+        if (_mm_movemask_epi8(h) != 0xffff)
+            return false;
+    }
+#endif
+    for (; j < M->len; ++j)
+        if ((p[j] | f[j]) != n[j])
+            return false;
+    return true;
+}
+
+static void matcher_nocase(struct matcher *M, struct search const *S)
+{
+    M->len = S->len;
+    M->verify = verify_nocase;
+    M->alts = 1;
+    M->alt[0].first = S->needle[0];
+    M->alt[0].first_fold = S->needle[S->len];
+    M->alt[0].last = S->needle[S->len - 1];
+    M->alt[0].last_fold = S->needle[2 * S->len - 1];
+#ifdef __SSE2__
+    M->block = candidates;
+#endif
+}
+
+static bool verify_value_exact(struct matcher *M, byte const *p)
+{
+    struct search const *S = M->search;
+    return (S->value.little && !memcmp(p, S->needle, S->len))
+        || (S->value.big && !memcmp(p, S->needle + S->len, S->len));
+}
+
+static double decode_float(byte const *p, size_t len, bool big)
+{
+    uint64_t bits = 0;
+    for (size_t i = 0; i < len; ++i)
+        bits |= (uint64_t) p[big ? len - 1 - i : i] << 8 * i;
+
+    if (len == 4) {
+        uint32_t u = bits;
+        float f;
+        memcpy(&f, &u, sizeof(f));
+        return f;
+    }
+    double d;
+    memcpy(&d, &bits, sizeof(d));
+    return d;
+}
+
+static bool verify_value_approx(struct matcher *M, byte const *p)
+{
+    struct search const *S = M->search;
+    return (S->value.little && fabs(decode_float(p, S->len, false) - S->value.val) <= S->value.tol)
+        || (S->value.big && fabs(decode_float(p, S->len, true) - S->value.val) <= S->value.tol);
+}
+
+#ifdef __SSE2__
+/* bits of the float nearest to x, rounded one step further in direction dir */
+static uint64_t float_bits(double x, size_t len, int dir)
+{
+    if (len == 4) {
+        float f = x > FLT_MAX ? INFINITY : nextafterf(x, dir < 0 ? 0 : INFINITY);
+        uint32_t u;
+        memcpy(&u, &f, sizeof(u));
+        return u;
+    }
+    uint64_t u;
+    x = nextafter(x, dir < 0 ? 0 : INFINITY);
+    memcpy(&u, &x, sizeof(u));
+    return u;
+}
+
+/*
+ * Floats of one sign are ordered like their bits, so magnitudes in [from,
+ * to] bound the top byte, and the next one too where the top bytes agree.
+ */
+static void value_range(struct matcher *M, struct search const *S, double from, double to, bool negative)
+{
+    unsigned shift = 8 * M->len - 8;
+    uint64_t a = float_bits(from, M->len, -1), b = float_bits(to, M->len, +1);
+    bool same = a >> shift == b >> shift;
+
+    for (unsigned big = 0; big < 2; ++big) {
+        if (!(big ? S->value.big : S->value.little))
+            continue;
+        M->range[M->ranges].top = big ? 0 : M->len - 1;
+        M->range[M->ranges].next = big ? 1 : M->len - 2;
+        M->range[M->ranges].top_min = a >> shift | (negative ? 0x80 : 0);
+        M->range[M->ranges].top_max = b >> shift | (negative ? 0x80 : 0);
+        M->range[M->ranges].next_min = same ? a >> (shift - 8) & 0xff : 0;
+        M->range[M->ranges].next_max = same ? b >> (shift - 8) & 0xff : 0xff;
+        ++M->ranges;
+    }
+}
+#endif
+
+static void matcher_value(struct matcher *M, struct search const *S)
+{
+    M->len = S->len;
+
+    if (S->value.is_float && S->value.tol > 0) {
+        M->verify = verify_value_approx;
+#ifdef __SSE2__
+        /* wide enough for the rounding of the subtraction in verify_value_approx() */
+        double slack = (fabs(S->value.val) + S->value.tol) * DBL_EPSILON;
+        double lo = S->value.val - S->value.tol - slack, hi = S->value.val + S->value.tol + slack;
+        if (hi >= 0)
+            value_range(M, S, fmax(lo, 0), hi, false);
+        if (lo <= 0)
+            value_range(M, S, fmax(-hi, 0), -lo, true);
+        M->block = range_block;
+#endif
+        return;
+    }
+
+    M->verify = verify_value_exact;
+    if (S->value.little) {
+        M->alt[M->alts].first = S->needle[0];
+        M->alt[M->alts++].last = S->needle[S->len - 1];
+    }
+    if (S->value.big) {
+        M->alt[M->alts].first = S->needle[S->len];
+        M->alt[M->alts++].last = S->needle[2 * S->len - 1];
+    }
+#ifdef __SSE2__
+    M->block = candidates;
+#endif
+}
+
+static bool verify_approx(struct matcher *M, byte const *p)
+{
+    return distance(M->search, p, M->search->approx.max) <= M->search->approx.max;
+}
+
+static void matcher_approx(struct matcher *M, struct search const *S)
+{
+    M->len = S->len;
+    M->verify = verify_approx;
+#ifdef __SSE2__
+    if (S->approx.max < 0xff) /* fits the saturating counters */
+        M->block = approx_block;
+#endif
+}
+
+ssize_t search_next(struct search const *search, struct blob const *blob, size_t start, ssize_t dir)
+{
+    struct matcher M = {.search = search};
+    uint64_t tr = trace_begin();
+    ssize_t r;
+
+    switch (search->type) {
+    case SEARCH_BYTES:
+        r = blob_search(blob, search->needle, search->len, start, dir);
+        goto out;
+    case SEARCH_NOCASE:
+        matcher_nocase(&M, search);
+        break;
+    case SEARCH_VALUE:
+        matcher_value(&M, search);
+        break;
+    case SEARCH_APPROX:
+        matcher_approx(&M, search);
+        break;
+    default:
+        die("bad search type");
+    }
+
+    r = scan_wrap(&M, blob, start, dir);
+out:
+    trace_end("search_next", tr);
+    return r;
+}
+
+
+/*
+ * Byte classes: runs of at least RUN_MIN bytes 00 or ff, and everything
+ * else ("data").  Scanned sixteen bytes at a time where possible.
+ */
+
+#define RUN_MIN 16
+
+struct runs {
+    ssize_t dir;
+    int skip;     /* byte value to skip over, or -1 to look for a run */
+    size_t n[2];  /* 00 and ff bytes seen in a row, looking for a run */
+};
+
+static byte const run_byte[2] = {0x00, 0xff};
+
+/* number of equal bytes at the low and high end of a 16-byte compare mask */
+static inline unsigned ones_low(unsigned m)  { return __builtin_ctz(~m); }
+static inline unsigned ones_high(unsigned m) { return __builtin_clz(~(m << 16)); }
+
+/*
+ * Runs the scan over p[0..cnt), which holds positions off.. of the blob.
+ * Returns the first byte differing from R->skip, or otherwise the first
+ * byte (forward) or last byte (backward) of the first run found.
+ */
+static ssize_t runs_span(struct runs *R, byte const *p, size_t cnt, size_t off)
+{
+    size_t j = R->dir > 0 ? 0 : cnt;
+    ssize_t r = -1;
+
+#ifdef __SSE2__
+    for (; R->dir > 0 ? j + 16 <= cnt : j >= 16; j += R->dir > 0 ? 16 : -16) {
+        size_t a = R->dir > 0 ? j : j - 16;
+        __m128i x = _mm_loadu_si128((__m128i const *) (p + a));
+        unsigned m[2] = {
+            _mm_movemask_epi8(_mm_cmpeq_epi8(x, _mm_setzero_si128())),
+            _mm_movemask_epi8(_mm_cmpeq_epi8(x, _mm_set1_epi8(-1))),
+        };
+
+        if (R->skip >= 0) {
+            unsigned s = m[R->skip != 0];
+            if (s != 0xffff)
+                return off + a + (R->dir > 0 ? ones_low(s) : 15 - ones_high(s));
+            continue;
+        }
+
+        for (unsigned v = 0; v < 2; ++v) {
+            if (R->dir > 0) {
+                if (R->n[v] + ones_low(m[v]) >= RUN_MIN) {
+                    size_t i = off + a - R->n[v];
+                    if (r < 0 || i < (size_t) r)
+                        r = i;
+                }
+                R->n[v] = ones_high(m[v]);
+            }
+            else {
+                if (R->n[v] + ones_high(m[v]) >= RUN_MIN) {
+                    size_t i = off + a + 15 + R->n[v];
+                    if (r < 0 || i > (size_t) r)
+                        r = i;
+                }
+                R->n[v] = ones_low(m[v]);
+            }
+        }
+        if (r >= 0)
+            return r;
+    }
+#endif
+
+    while (R->dir > 0 ? j < cnt : j > 0) {
+        size_t i = R->dir > 0 ? j++ : --j;
+
+        if (R->skip >= 0) {
+            if (p[i] != run_byte[R->skip != 0])
+                return off + i;
+            continue;
+        }
+
+        for (unsigned v = 0; v < 2; ++v) {
+            if (p[i] != run_byte[v])
+                R->n[v] = 0;
+            else if (++R->n[v] >= RUN_MIN)
+                return off + i + (R->dir > 0 ? 1 - RUN_MIN : RUN_MIN - 1);
+        }
+    }
+
+    return -1;
+}
+
+/* scans positions [lo, hi) in direction R->dir */
+static ssize_t runs_scan(struct runs *R, struct blob const *blob, size_t lo, size_t hi)
+{
+    while (lo < hi) {
+        size_t s = R->dir > 0 ? lo : hi - min(hi - lo, SCAN_CHUNK), n;
+        size_t e = R->dir > 0 ? min(hi, s + SCAN_CHUNK) : hi;
+        byte const *p = blob_lookup(blob, s, &n);
+        ssize_t r;
+
+        /* backwards, start with the span holding the last byte */
+        while (R->dir < 0 && s + n < e)
+            p = blob_lookup(blob, s += n, &n);
+        n = min(n, e - s);
+
+        if ((r = runs_span(R, p, n, s)) >= 0)
+            return r;
+
+        if (R->dir > 0)
+            lo = s + n;
+        else
+            hi = s;
+    }
+
+    return -1;
+}
+
+/* whether a run of RUN_MIN bytes equal to blob[pos] starts (dir > 0) or ends there */
+static bool in_run(struct blob const *blob, size_t pos, ssize_t dir)
+{
+    byte b = blob_at(blob, pos);
+    size_t k;
+
+    if (b != 0x00 && b != 0xff)
+        return false;
+    for (k = 1; k < RUN_MIN; ++k) {
+        if (dir > 0 ? pos + k >= blob_length(blob) : pos < k)
+            return false;
+        if (blob_at(blob, dir > 0 ? pos + k : pos - k) != b)
+            return false;
+    }
+    return true;
+}
+
+/*
+ * Next (dir > 0) or previous position where the byte class changes: the
+ * end of the run or data region at pos, or the start of the one before
+ * it.  Stops at the ends of the blob.
+ */
+size_t search_class_change(struct blob const *blob, size_t pos, ssize_t dir)
+{
+    size_t len = blob_length(blob);
+    struct runs R = {.dir = dir, .skip = -1};
+    ssize_t r;
+
+    if (dir > 0 ? pos + 1 >= len : !pos)
+        return pos;
+
+    uint64_t tr = trace_begin();
+    if (dir > 0) {
+        if (in_run(blob, pos, dir))
+            R.skip = blob_at(blob, pos);
+        r = runs_scan(&R, blob, pos, len);
+        pos = r >= 0 ? (size_t) r : len - 1;
+    }
+    else {
+        if (in_run(blob, pos - 1, dir))
+            R.skip = blob_at(blob, pos - 1);
+        r = runs_scan(&R, blob, 0, pos);
+        pos = r >= 0 ? (size_t) r + 1 : 0;
+    }
+
+    trace_end("class_change", tr);
+    return pos;
+}
@@ -0,0 +1,46 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include "common.h"
+
+struct blob;
+
+enum search_type {
+    SEARCH_BYTES = 0,
+    SEARCH_NOCASE,
+    SEARCH_VALUE,
+    SEARCH_APPROX,
+};
+
+struct search {
+    enum search_type type;
+
+    size_t len;
+    byte *needle;
+
+    struct {
+        bool is_float;
+        bool little, big; /* byte orders to look for */
+        double val, tol;
+    } value;
+
+    struct {
+        bool bits;  /* count differing bits rather than bytes */
+        size_t max;
+    } approx;
+};
+
+void search_init(struct search *search);
+void search_free(struct search *search);
+
+void search_nocase(struct search *search, byte const *needle, size_t len, size_t stride);
+bool search_value(struct search *search, char const *type, char const *val, char const *tol);
+bool search_approx(struct search *search, byte const *needle, size_t len, size_t max, bool bits);
+
+size_t search_distance(struct search const *search, struct blob const *blob, size_t pos);
+
+ssize_t search_next(struct search const *search, struct blob const *blob, size_t start, ssize_t dir);
+
+size_t search_class_change(struct blob const *blob, size_t pos, ssize_t dir);
+
+#endif
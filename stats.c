@@ -0,0 +1,47 @@
+
+#define _GNU_SOURCE
+
+#include "stats.h"
+
+#include "blob.h"
+#include "history.h"
+#include "screen.h"
+
+struct stats stats;
+
+static char const *names[STAT_TIMERS] = {
+    [STAT_RENDER] = "render",
+    [STAT_KEY]    = "key",
+    [STAT_SEARCH] = "search",
+    [STAT_SAVE]   = "save",
+    [STAT_LOAD]   = "load",
+};
+
+void stats_print(FILE *fp, struct blob const *blob)
+{
+    size_t undo_cnt, undo_bytes, redo_cnt, redo_bytes;
+
+    fprintf(fp, "%-8s %10s %10s %10s %8s\n", "(ms)", "last", "avg", "max", "count");
+    for (size_t i = 0; i < STAT_TIMERS; ++i) {
+        struct stat_time const *t = &stats.time[i];
+        fprintf(fp, "%-8s %10.3f %10.3f %10.3f %8zu\n", names[i],
+                t->last / 1e3, t->count ? t->total / 1e3 / t->count : 0., t->max / 1e3, t->count);
+    }
+
+    history_stats(blob->undo, &undo_cnt, &undo_bytes);
+    history_stats(blob->redo, &redo_cnt, &redo_bytes);
+
+    fprintf(fp, "save:    %zu syscalls\n", stats.save_syscalls);
+    fprintf(fp, "screen:  %zu bytes written, %zu in the last frame\n",
+            screen.total_bytes, screen.frame_bytes);
+    fprintf(fp, "rows:    %zu rendered, %zu from the cache\n",
+            stats.rows_rendered, stats.rows_cached);
+    fprintf(fp, "undo:    %zu changes, %zu bytes; redo: %zu changes, %zu bytes\n",
+            undo_cnt, undo_bytes, redo_cnt, redo_bytes);
+    if (blob->alloc == BLOB_MMAP)
+        fprintf(fp, "memory:  %zu bytes mapped, %zu dirty pages, clipboard %zu bytes\n",
+                blob->len, blob_dirty_pages(blob), blob->clipboard.len);
+    else
+        fprintf(fp, "memory:  %zu bytes allocated, clipboard %zu bytes\n",
+                blob->len, blob->clipboard.len);
+}
@@ -0,0 +1,51 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include "common.h"
+
+struct blob;
+
+/* operations whose duration is tracked */
+enum stat_timer {
+    STAT_RENDER,
+    STAT_KEY,
+    STAT_SEARCH,
+    STAT_SAVE,
+    STAT_LOAD,
+    STAT_TIMERS,
+};
+
+struct stat_time {
+    uint64_t last, max, total;  /* microseconds */
+    size_t count;
+};
+
+struct stats {
+    struct stat_time time[STAT_TIMERS];
+
+    uint64_t wait;  /* microseconds blocked on input during the current key */
+    size_t save_syscalls;  /* issued by the last blob_save() */
+    size_t rows_rendered, rows_cached;
+};
+
+extern struct stats stats;
+
+static inline void stats_record(enum stat_timer which, uint64_t us)
+{
+    struct stat_time *t = &stats.time[which];
+    t->last = us;
+    if (us > t->max)
+        t->max = us;
+    t->total += us;
+    ++t->count;
+}
+
+/* for stats_record(which, monotonic_microtime() - start) */
+static inline void stats_since(enum stat_timer which, uint64_t start)
+{
+    stats_record(which, monotonic_microtime() - start);
+}
+
+void stats_print(FILE *fp, struct blob const *blob);
+
+#endif
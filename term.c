@@ -28,6 +28,8 @@ void term_text(bool leave_alternate)
     if (!term.initialized)
         return;
 
+    if (term.mouse)
+        fputs(mouse_off, stdout);
     if (leave_alternate)
         fputs(leave_alternate_screen, stdout);
     cursor_column(0);
@@ -53,9 +55,18 @@ void term_visual(void)
 
     fputs(enter_alternate_screen, stdout);
     fputs(hide_cursor, stdout);
+    if (term.mouse)
+        fputs(mouse_on, stdout);
     fflush(stdout);
 }
 
+void term_mouse(bool on)
+{
+    if (on != term.mouse)
+        fputs(on ? mouse_on : mouse_off, stdout);
+    term.mouse = on;
+}
+
 void term_size(unsigned *width, unsigned *height)
 {
     struct winsize winsz;
@@ -10,10 +10,9 @@ struct term
 
     bool is_basic;  /* no scrolling, limited formatting */
 
-    struct termios attrs;
+    bool mouse;  /* report mouse clicks in visual mode */
 
-    bool winch;
-    bool tstp, cont;
+    struct termios attrs;
 };
 
 extern struct term term;  /* term.c */
@@ -22,5 +21,6 @@ void term_init(void);
 void term_text(bool leave_alternate);
 void term_visual(void);
 void term_size(unsigned *width, unsigned *height);
+void term_mouse(bool on);
 
 #endif
@@ -0,0 +1,140 @@
+
+#define _GNU_SOURCE
+
+#include "trace.h"
+
+#include <time.h>
+#include <pthread.h>
+
+#define CHUNK_EVENTS 0x1000
+
+struct chunk {
+    size_t len;
+    struct {
+        char const *name;
+        uint64_t start, end;
+    } ev[CHUNK_EVENTS];
+    struct chunk *next;
+};
+
+bool trace_on;
+
+static struct {
+    FILE *fp;
+    bool first;
+    uint64_t epoch;
+
+    pthread_t writer;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool stop;
+
+    struct chunk *cur;  /* being filled */
+    struct chunk *queue, **tail;  /* full, waiting for the writer */
+} trace = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+};
+
+uint64_t trace_now(void)
+{
+    struct timespec t;
+    if (clock_gettime(CLOCK_MONOTONIC, &t))
+        pdie("clock_gettime");
+    return (uint64_t) t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+static void write_chunk(struct chunk *c)
+{
+    for (size_t i = 0; i < c->len; ++i) {
+        fprintf(trace.fp, "%s{\"name\": \"%s\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, \"pid\": 1, \"tid\": 1}",
+                trace.first ? "" : ",\n", c->ev[i].name,
+                (c->ev[i].start - trace.epoch) / 1e3, (c->ev[i].end - c->ev[i].start) / 1e3);
+        trace.first = false;
+    }
+}
+
+static void *writer(void *arg)
+{
+    (void) arg;
+
+    pthread_mutex_lock(&trace.lock);
+    while (true) {
+        while (!trace.queue && !trace.stop)
+            pthread_cond_wait(&trace.cond, &trace.lock);
+        if (!trace.queue)
+            break;
+
+        struct chunk *c = trace.queue;
+        if (!(trace.queue = c->next))
+            trace.tail = &trace.queue;
+
+        pthread_mutex_unlock(&trace.lock);
+        write_chunk(c);
+        free(c);
+        pthread_mutex_lock(&trace.lock);
+    }
+    pthread_mutex_unlock(&trace.lock);
+
+    return NULL;
+}
+
+/* with trace.lock held */
+static void submit(void)
+{
+    trace.cur->next = NULL;
+    *trace.tail = trace.cur;
+    trace.tail = &trace.cur->next;
+    trace.cur = NULL;
+    pthread_cond_signal(&trace.cond);
+}
+
+static void trace_close(void)
+{
+    pthread_mutex_lock(&trace.lock);
+    trace_on = false;
+    if (trace.cur)
+        submit();
+    trace.stop = true;
+    pthread_cond_signal(&trace.cond);
+    pthread_mutex_unlock(&trace.lock);
+
+    pthread_join(trace.writer, NULL);
+
+    fprintf(trace.fp, "\n]\n");
+    if (fclose(trace.fp))
+        perror("could not write trace"); /* we're exiting anyway */
+}
+
+void trace_init(char const *filename)
+{
+    if (!(trace.fp = fopen(filename, "w")))
+        pdie("could not open trace file");
+    fprintf(trace.fp, "[\n");
+
+    trace.first = true;
+    trace.epoch = trace_now();
+    trace.tail = &trace.queue;
+
+    thread_create_strict(&trace.writer, writer, NULL);
+
+    atexit(trace_close); /* also when dying */
+    trace_on = true;
+}
+
+void trace_span(char const *name, uint64_t start, uint64_t end)
+{
+    pthread_mutex_lock(&trace.lock);
+    if (trace_on) {
+        if (!trace.cur) {
+            trace.cur = malloc_strict(sizeof(*trace.cur));
+            trace.cur->len = 0;
+        }
+        trace.cur->ev[trace.cur->len].name = name;
+        trace.cur->ev[trace.cur->len].start = start;
+        trace.cur->ev[trace.cur->len].end = end;
+        if (++trace.cur->len == CHUNK_EVENTS)
+            submit();
+    }
+    pthread_mutex_unlock(&trace.lock);
+}
@@ -0,0 +1,25 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "common.h"
+
+/*
+ * Chrome trace-event output (chrome://tracing, Perfetto), enabled by
+ * setting HYX_TRACE to a filename.  Spans are buffered in memory and
+ * written by a background thread.
+ */
+
+extern bool trace_on;
+
+void trace_init(char const *filename);
+
+uint64_t trace_now(void);  /* nanoseconds */
+void trace_span(char const *name, uint64_t start, uint64_t end);
+
+/* name must be a string literal */
+static inline uint64_t trace_begin(void)
+    { return trace_on ? trace_now() : 0; }
+static inline void trace_end(char const *name, uint64_t start)
+    { if (trace_on) trace_span(name, start, trace_now()); }
+
+#endif
@@ -0,0 +1,166 @@
+
+#define _GNU_SOURCE
+
+#include "transform.h"
+
+#include <assert.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "blob.h"
+#include "trace.h"
+
+/* read, transformed and written back this much at a time */
+#define TRANSFORM_CHUNK ((size_t) 1 << 20)
+
+static void xor_bytes(byte *p, byte const *k, size_t n)
+{
+    size_t j = 0;
+#ifdef __SSE2__
+    for (; j + 16 <= n; j += 16) {
+        __m128i x = _mm_loadu_si128((__m128i const *) (p + j));
+        __m128i y = _mm_loadu_si128((__m128i const *) (k + j));
+        _mm_storeu_si128((__m128i *) (p + j), _mm_xor_si128(x, y));
+    }
+#endif
+    for (; j < n; ++j)
+        p[j] ^= k[j];
+}
+
+static void add_bytes(byte *p, byte const *k, size_t n)
+{
+    size_t j = 0;
+#ifdef __SSE2__
+    for (; j + 16 <= n; j += 16) {
+        __m128i x = _mm_loadu_si128((__m128i const *) (p + j));
+        __m128i y = _mm_loadu_si128((__m128i const *) (k + j));
+        _mm_storeu_si128((__m128i *) (p + j), _mm_add_epi8(x, y));
+    }
+#endif
+    for (; j < n; ++j)
+        p[j] += k[j];
+}
+
+/* 0 < r < 8 */
+static void rol_bytes(byte *p, unsigned r, size_t n)
+{
+    size_t j = 0;
+#ifdef __SSE2__
+    /* there are no byte shifts; shift words and drop what crossed into the other byte */
+    __m128i const lmask = _mm_set1_epi8((char) (0xff << r & 0xff));
+    __m128i const rmask = _mm_set1_epi8((char) (0xff >> (8 - r)));
+    __m128i const l = _mm_cvtsi32_si128(r), rr = _mm_cvtsi32_si128(8 - r);
+    for (; j + 16 <= n; j += 16) {
+        __m128i x = _mm_loadu_si128((__m128i const *) (p + j));
+        x = _mm_or_si128(_mm_and_si128(_mm_sll_epi16(x, l), lmask),
+                         _mm_and_si128(_mm_srl_epi16(x, rr), rmask));
+        _mm_storeu_si128((__m128i *) (p + j), x);
+    }
+#endif
+    for (; j < n; ++j)
+        p[j] = p[j] << r | p[j] >> (8 - r);
+}
+
+/* n is a multiple of w, which is 2, 4 or 8 */
+static void bswap_words(byte *p, unsigned w, size_t n)
+{
+    size_t j = 0;
+#ifdef __SSE2__
+    for (; j + 16 <= n; j += 16) {
+        __m128i x = _mm_loadu_si128((__m128i const *) (p + j));
+        x = _mm_or_si128(_mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8));
+        if (w == 4) {
+            x = _mm_shufflelo_epi16(x, _MM_SHUFFLE(2, 3, 0, 1));
+            x = _mm_shufflehi_epi16(x, _MM_SHUFFLE(2, 3, 0, 1));
+        }
+        else if (w == 8) {
+            x = _mm_shufflelo_epi16(x, _MM_SHUFFLE(0, 1, 2, 3));
+            x = _mm_shufflehi_epi16(x, _MM_SHUFFLE(0, 1, 2, 3));
+        }
+        _mm_storeu_si128((__m128i *) (p + j), x);
+    }
+#endif
+    for (; j < n; j += w) {
+        uint16_t h;
+        uint32_t s;
+        uint64_t d;
+        switch (w) {
+        case 2:
+            memcpy(&h, p + j, 2);
+            h = __builtin_bswap16(h);
+            memcpy(p + j, &h, 2);
+            break;
+        case 4:
+            memcpy(&s, p + j, 4);
+            s = __builtin_bswap32(s);
+            memcpy(p + j, &s, 4);
+            break;
+        case 8:
+            memcpy(&d, p + j, 8);
+            d = __builtin_bswap64(d);
+            memcpy(p + j, &d, 8);
+            break;
+        default:
+            die("bad word size");
+        }
+    }
+}
+
+/*
+ * Transforms [pos, pos + len) chunk by chunk, as one change for undo.
+ * Calls progress (if given) after each chunk.
+ */
+void transform_apply(struct blob *blob, size_t pos, size_t len, struct transform const *T,
+        void (*progress)(void *arg, size_t done, size_t total), void *arg)
+{
+    uint64_t tr = trace_begin();
+    size_t const chunk = min(len, TRANSFORM_CHUNK);
+    byte *buf = malloc_strict(chunk), *keys = NULL;
+
+    assert(pos + len <= blob_length(blob));
+    assert(T->op != TRANSFORM_BSWAP || !(len % T->n));
+
+    if (T->op == TRANSFORM_XOR || T->op == TRANSFORM_ADD) {
+        /* the key over and over, so that any phase of it lines up with a chunk */
+        size_t size = chunk + T->key_len;
+        keys = malloc_strict(size);
+        memcpy(keys, T->key, T->key_len);
+        for (size_t have = T->key_len; have < size; have *= 2)
+            memcpy(keys + have, keys, min(have, size - have));
+    }
+
+    blob_remember(blob, REPLACE, pos, len);
+
+    for (size_t off = 0, n; off < len; off += n) {
+        n = min(len - off, chunk);
+        blob_read_strict(blob, pos + off, buf, n);
+
+        switch (T->op) {
+        case TRANSFORM_XOR:
+            xor_bytes(buf, keys + off % T->key_len, n);
+            break;
+        case TRANSFORM_ADD:
+            add_bytes(buf, keys + off % T->key_len, n);
+            break;
+        case TRANSFORM_ROL:
+            if (T->n % 8)
+                rol_bytes(buf, T->n % 8, n);
+            break;
+        case TRANSFORM_BSWAP:
+            bswap_words(buf, T->n, n);
+            break;
+        default:
+            die("unknown transform");
+        }
+
+        blob_replace(blob, pos + off, buf, n, false);
+        if (progress)
+            progress(arg, off + n, len);
+    }
+
+    free(keys);
+    free(buf);
+    trace_end("transform", tr);
+}
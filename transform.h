@@ -0,0 +1,25 @@
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include "common.h"
+
+struct blob;
+
+enum transform_op {
+    TRANSFORM_XOR,
+    TRANSFORM_ADD,
+    TRANSFORM_ROL,
+    TRANSFORM_BSWAP,
+};
+
+struct transform {
+    enum transform_op op;
+    byte const *key;  /* xor, add: repeated from the start of the range */
+    size_t key_len;
+    unsigned n;       /* rol: bits to rotate each byte by; bswap: word size */
+};
+
+void transform_apply(struct blob *blob, size_t pos, size_t len, struct transform const *T,
+        void (*progress)(void *arg, size_t done, size_t total), void *arg);
+
+#endif
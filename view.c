@@ -2,20 +2,80 @@
 #include "view.h"
 
 #include <ctype.h>
+#include <limits.h>
 
 #include "ansi.h"
 #include "common.h"
 #include "blob.h"
 #include "term.h"
 #include "input.h"
+#include "screen.h"
+#include "trace.h"
+#include "stats.h"
+#include "minimap.h"
 
-static void print(char const *s) { fputs(s, stdout); }
+/* columns taken by the minimap */
+#define MAP_WIDTH 3
+
+/* rendered rows kept around for all panes */
+#define CACHE_ROWS 0x200
+
+/* per-byte lookup table for rendering */
+static struct {
+    char hex[2];
+    char ascii;
+    enum color color;
+} glyphs[256];
+
+static void glyphs_init(void)
+{
+    static char const digits[] = "0123456789abcdef";
+    for (unsigned b = 0; b < 256; ++b) {
+        glyphs[b].hex[0] = digits[b >> 4];
+        glyphs[b].hex[1] = digits[b & 0xf];
+        glyphs[b].ascii = isprint(b) ? b : '.';
+        glyphs[b].color = isalnum(b) ? COLOR_CYAN
+                        : isprint(b) ? COLOR_BLUE
+                        : !b ? COLOR_RED
+                        : COLOR_NORMAL;
+    }
+}
+
+/*
+ * Rows without the cursor or the selection look the same in every pane
+ * showing them, so they are kept by position and layout until the blob
+ * observers drop them because the bytes changed.
+ */
+static struct cached_row {
+    struct blob const *blob;  /* none if unused */
+    size_t off;
+    unsigned cols, cnt, pos_digits, width;
+    bool color;
+    unsigned n, cap;
+    struct cell *cells;
+} cache[CACHE_ROWS];
 
 static size_t view_end(struct view const *view)
 {
     return view->start + view->rows * view->cols;
 }
 
+static void changed(void *arg, size_t pos, size_t old_len, size_t new_len)
+{
+    struct view *view = arg;
+    /* after an insertion or deletion, everything behind moved */
+    size_t to = old_len == new_len ? pos + new_len : SIZE_MAX;
+
+    for (struct cached_row *c = cache; c < cache + CACHE_ROWS; ++c)
+        if (c->blob == view->blob && c->off < to && pos < c->off + c->cols)
+            c->blob = NULL;
+
+    /* row position pos shows blob position pos + shift */
+    ssize_t from = pos - view->shift, end = to == SIZE_MAX ? SSIZE_MAX : (ssize_t) (to - view->shift);
+    if (end > 0)
+        view_dirty_fromto(view, from > 0 ? from : 0, end);
+}
+
 void view_init(struct view *view, struct blob *blob, struct input *input)
 {
     memset(view, 0, sizeof(*view));
@@ -23,12 +83,27 @@ void view_init(struct view *view, struct blob *blob, struct input *input)
     view->input = input;
     view->pos_digits = 4; /* rather arbitrary */
     view->color = !term.is_basic;
+    glyphs_init();
+
+    view->observer.changed = changed;
+    view->observer.arg = view;
+    blob_observe(blob, &view->observer);
+}
+
+static unsigned map_width(struct view const *view)
+{
+    return view->map && view->width > 4 * MAP_WIDTH ? MAP_WIDTH : 0;
+}
+
+static unsigned text_width(struct view const *view)
+{
+    return view->width - map_width(view);
 }
 
 static unsigned view_max_cols(struct view const *view)
 {
     assert(view->width);
-    return (view->width - (view->pos_digits + strlen(": ") + strlen("||"))) / strlen("xx c");
+    return (text_width(view) - (view->pos_digits + strlen(": ") + strlen("||"))) / strlen("xx c");
 }
 
 static inline size_t satadd(size_t x, size_t y, size_t b) { assert(b >= 1); return min(b - 1, x + y); }
@@ -62,10 +137,32 @@ void view_set_cols(struct view *view, bool relative, int cols)
     view_adjust(view);
 }
 
+/* gives the view a part of the terminal, sharing it with the peer in diff mode */
+void view_layout(struct view *view, unsigned left, unsigned top, unsigned width, unsigned height)
+{
+    view->left = left;
+    view->top = top;
+    view->width = view->peer ? width / 2 : width;
+    view->height = height;
+
+    if (view->peer) {
+        view->peer->left = left + view->width;
+        view->peer->top = top;
+        view->peer->width = width - view->width;
+        view->peer->height = height;
+    }
+
+    view_recompute(view, true);
+    view_dirty_from(view, 0);
+}
+
 void view_recompute(struct view *view, bool changed)
 {
     unsigned old_rows = view->rows, old_cols = view->cols;
-    unsigned digs = (bit_length(max(2, blob_length(view->blob)) - 1) + 3) / 4;
+    size_t len = blob_length(view->blob);
+    if (view->peer)
+        len = max(len, blob_length(view->peer->blob));
+    unsigned digs = (bit_length(max(2, len) - 1) + 3) / 4;
 
     if (digs > view->pos_digits) {
         view->pos_digits = digs;
@@ -99,175 +196,400 @@ void view_recompute(struct view *view, bool changed)
     view_dirty_from(view, 0);
 
     view_adjust(view);
-
-    print(clear_screen);
 }
 
 void view_free(struct view *view)
 {
+    if (view->map) {
+        minimap_release();
+        term_mouse(minimap_shown());
+    }
+    blob_unobserve(view->blob, &view->observer);
     free(view->dirty);
+    free(view->message);
+}
+
+/* the rows kept for all views; when none are left */
+void view_cache_free(void)
+{
+    for (struct cached_row *c = cache; c < cache + CACHE_ROWS; ++c)
+        free(c->cells);
+    memset(cache, 0, sizeof(cache));
 }
 
-void view_message(struct view *view, char const *msg, char const *color)
+/* shown on the last line by the next view_update() */
+void view_message(struct view *view, char const *msg, enum color color)
 {
-    cursor_line(view->rows - 1);
-    print(clear_line);
-    if (view->color && color) print(color);
-    printf("%*c  %s", view->pos_digits, ' ', msg);
-    if (view->color && color) print(color_normal);
-    fflush(stdout);
-    view->dirty[view->rows - 1] = 2; /* redraw at the next keypress */
+    free(view->message);
+    view->message = strdup_strict(msg);
+    view->message_color = color;
 }
 
 void view_error(struct view *view, char const *msg)
 {
-    view_message(view, msg, color_red);
+    view_message(view, msg, COLOR_RED);
 }
 
 /* FIXME hex and ascii mode look very similar */
-static void render_line(struct view *view, size_t off, size_t last)
+static unsigned render_line(struct view *view, size_t off, size_t last, struct cell *line)
 {
-    byte b;
-    char digits[0x10], *hexptr, *asciiptr;
-    size_t hexlen, asciilen;
-    FILE *hexfp, *asciifp;
     struct input *I = view->input;
-
+    struct view const *P = view->peer;
+    size_t const len = blob_length(view->blob), plen = P ? blob_length(P->blob) : 0;
+    size_t const cnt = min(view->cols, last - off); /* cells with contents */
     size_t const sel_start = min(I->cur, I->sel), sel_end = max(I->cur, I->sel);
-    char const *last_color = NULL, *next_color;
+    /* blob positions of the row; out of range (wrapped) before the start in diff mode */
+    size_t const base = off + view->shift, pbase = P ? off + P->shift : 0;
+    bool const lead = I->view == view && !view->inactive;
+    byte const *data = NULL, *pdata = NULL;
+    size_t avail = 0, pavail = 0;
+    unsigned const width = text_width(view);
+    unsigned x = 0;
+    uint8_t fg = 0, diff;
+    char buf[0x40];
+    int n;
+    byte b;
+
+    if (base < len)
+        data = blob_lookup(view->blob, base, &avail);
+    if (pbase < plen)
+        pdata = blob_lookup(P->blob, pbase, &pavail);
+#define HAS(J) (base + (J) < len)
+#define BYTE(J) ((J) < avail ? data[J] : blob_at(view->blob, base + (J)))
+#define PEER(J) ((J) < pavail ? pdata[J] : blob_at(P->blob, pbase + (J)))
+#define DIFF(J) (P && (HAS(J) || pbase + (J) < plen) \
+        && !(HAS(J) && pbase + (J) < plen && BYTE(J) == PEER(J)) ? ATTR_INVERSE : 0)
+#define PUT(G, A) do { if (x < width) line[x] = (struct cell) {(G), (A)}; ++x; } while (0)
+#define FG(C) (view->color ? (C) : COLOR_NORMAL)
 
-    if (!(hexfp = open_memstream(&hexptr, &hexlen)))
-        pdie("open_memstream");
-    if (!(asciifp = open_memstream(&asciiptr, &asciilen)))
-        pdie("open_memstream");
-#define BOTH(EX) for (FILE *fp; ; ) { fp = hexfp; EX; fp = asciifp; EX; break; }
+    ++stats.rows_rendered;
 
     if (off <= I->cur && I->cur < off + view->cols) {
         /* cursor in current line */
-        if (view->color) fputs(color_yellow, hexfp);
-        char const *space = &" "[I->cur >= ((size_t) 1 << 4 * view->pos_digits)]; /* in case cursor is just 1 past the end */
-        fprintf(hexfp, "%0*zx%c%s", view->pos_digits, I->cur, I->mode_insert ? '+' : '>', space);
-        if (view->color) fputs(color_normal, hexfp);
+        char const *space = &" "[I->cur + view->shift >= ((size_t) 1 << 4 * view->pos_digits)]; /* in case cursor is just 1 past the end */
+        if ((ssize_t) (I->cur + view->shift) < 0)
+            n = snprintf(buf, sizeof(buf), "%*s%c%s", view->pos_digits, "", I->mode_insert ? '+' : '>', space);
+        else
+            n = snprintf(buf, sizeof(buf), "%0*zx%c%s", view->pos_digits, I->cur + view->shift, I->mode_insert ? '+' : '>', space);
+        for (int i = 0; i < n && i < (int) sizeof(buf) - 1; ++i)
+            PUT(buf[i], FG(COLOR_YELLOW));
     }
     else {
-        fprintf(hexfp, "%0*zx: ", view->pos_digits, off);
+        if ((ssize_t) base < 0)
+            n = snprintf(buf, sizeof(buf), "%*s  ", view->pos_digits, "");
+        else
+            n = snprintf(buf, sizeof(buf), "%0*zx: ", view->pos_digits, base);
+        for (int i = 0; i < n && i < (int) sizeof(buf) - 1; ++i)
+            PUT(buf[i], 0);
     }
 
-    for (size_t j = 0, len = blob_length(view->blob); j < view->cols; ++j) {
-
-        if (off + j < len) {
-            sprintf(digits, "%02hhx", b = blob_at(view->blob, off + j));
+    /* hex part */
+    for (size_t j = 0; j < cnt; ++j) {
+        size_t const pos = off + j;
+        bool const in_selection = I->mode == SELECT && pos >= sel_start && pos <= sel_end;
+        char const *digits = HAS(j) ? glyphs[b = BYTE(j)].hex : (b = ' ', "  ");
+
+        diff = DIFF(j);
+        if (pos == I->cur) {
+            fg = FG(!HAS(j) ? COLOR_RED : COLOR_YELLOW);
+            if (!I->mode_ascii && lead) {
+                PUT(digits[0], fg | ATTR_INVERSE | ATTR_BOLD | (I->mode == INPUT && !I->low_nibble ? ATTR_UNDERLINE : 0));
+                PUT(digits[1], fg | ATTR_INVERSE | ATTR_BOLD | (I->mode == INPUT && I->low_nibble ? ATTR_UNDERLINE : 0));
+            }
+            else {
+                PUT(digits[0], fg | ATTR_INVERSE);
+                PUT(digits[1], fg | ATTR_INVERSE);
+            }
         }
         else {
-            b = ' ';
-            strcpy(digits, "  ");
+            fg = FG(in_selection ? COLOR_YELLOW : glyphs[b].color);
+            PUT(digits[0], fg | diff);
+            PUT(digits[1], fg | diff);
         }
 
-        bool in_selection = I->mode == SELECT && off + j >= sel_start && off + j <= sel_end;
+        if (view->color)
+            PUT(' ', fg);
+        else if (I->mode == SELECT && pos + 1 == sel_start)
+            PUT('<', 0);
+        else if (I->mode == SELECT && pos == sel_end)
+            PUT('>', 0);
+        else
+            PUT(in_selection ? '_' : ' ', 0);
+    }
+    for (size_t j = cnt; j < view->cols; ++j) {
+        PUT(' ', 0);
+        PUT(' ', 0);
+        PUT(' ', 0);
+    }
 
-        if (off + j >= last) {
-            for (size_t p = j; p < view->cols; ++p)
-                fputs("   ", hexfp);
-            break;
+    PUT('|', 0);
+
+    /* ascii part */
+    for (size_t j = 0; j < cnt; ++j) {
+        size_t const pos = off + j;
+        bool const in_selection = I->mode == SELECT && pos >= sel_start && pos <= sel_end;
+        b = HAS(j) ? BYTE(j) : ' ';
+
+        if (pos == I->cur) {
+            fg = FG(!HAS(j) ? COLOR_RED : COLOR_YELLOW);
+            PUT(glyphs[b].ascii, fg | ATTR_INVERSE | (I->mode == INPUT && I->mode_ascii && lead ? ATTR_BOLD | ATTR_UNDERLINE : 0));
+        }
+        else {
+            PUT(glyphs[b].ascii, FG(in_selection ? COLOR_YELLOW : glyphs[b].color) | DIFF(j));
         }
+    }
 
-        if (off + j == I->cur) {
-            next_color = I->cur >= len ? color_red : color_yellow;
-            BOTH(
-                if (view->color && next_color != last_color) fputs(next_color, fp);
-                fputs(inverse_video_on, fp);
-            );
-
-            if (!I->mode_ascii) {
-                fputs(bold_on, hexfp);
-                if (I->mode == INPUT && !I->low_nibble) fputs(underline_on, hexfp);
-                fputc(digits[0], hexfp);
-                if (I->mode == INPUT) fputs(I->low_nibble ? underline_on : underline_off, hexfp);
-                fputc(digits[1], hexfp);
-                if (I->mode == INPUT && I->low_nibble) fputs(underline_off, hexfp);
-                fputs(bold_off, hexfp);
-            }
-            else
-                fputs(digits, hexfp);
+    PUT('|', 0);
 
-            if (I->mode == INPUT && I->mode_ascii)
-                fprintf(asciifp, "%s%s%c%s%s", bold_on, underline_on, isprint(b) ? b : '.', underline_off, bold_off);
-            else
-                fputc(isprint(b) ? b : '.', asciifp);
+#undef FG
+#undef PUT
+#undef DIFF
+#undef PEER
+#undef BYTE
+#undef HAS
+    return min(x, width);
+}
 
-            BOTH(
-                fputs(inverse_video_off, fp);
-            );
+/* whether the row at off looks the same in every pane */
+static bool cacheable(struct view const *view, size_t off)
+{
+    struct input const *I = view->input;
+    size_t const end = off + view->cols;
+
+    if (view->peer || (off <= I->cur && I->cur < end))
+        return false;
+    /* a marker before the selection may be drawn in the preceding row */
+    return I->mode != SELECT || max(I->cur, I->sel) < off || min(I->cur, I->sel) > end;
+}
+
+static unsigned render_cached(struct view *view, size_t off, size_t last, struct cell *line)
+{
+    struct cached_row *c = &cache[(off / view->cols + (uintptr_t) view->blob / 64) % CACHE_ROWS];
+    unsigned const cnt = min(view->cols, last - off), width = text_width(view);
+
+    if (c->blob == view->blob && c->off == off && c->cols == view->cols && c->cnt == cnt
+            && c->pos_digits == view->pos_digits && c->width == width && c->color == view->color) {
+        memcpy(line, c->cells, c->n * sizeof(*line));
+        ++stats.rows_cached;
+        return c->n;
+    }
+
+    unsigned n = render_line(view, off, last, line);
+    if (c->cap < n)
+        c->cells = realloc_strict(c->cells, (c->cap = n) * sizeof(*c->cells));
+    memcpy(c->cells, line, n * sizeof(*line));
+    c->blob = view->blob;
+    c->off = off;
+    c->cols = view->cols;
+    c->cnt = cnt;
+    c->pos_digits = view->pos_digits;
+    c->width = width;
+    c->color = view->color;
+    c->n = n;
+    return n;
+}
+
+/* the part of the blob summarized in minimap row y */
+static void map_range(struct view const *view, unsigned y, size_t *from, size_t *to)
+{
+    size_t len = blob_length(view->blob);
+    size_t start = view->map_len ? min(view->map_start, len) : 0;
+    size_t span = view->map_len ? min(view->map_len, len - start) : len;
+
+    *from = start + (size_t) ((double) span * y / view->rows);
+    *to = start + (size_t) ((double) span * (y + 1) / view->rows);
+}
+
+static void render_map(struct view *view, unsigned y, struct cell *cells)
+{
+    static char const shades[] = "_.:-=+*#%@";
+    struct minimap_summary s;
+    size_t from, to;
+    uint8_t attr = 0;
+    char c = ' ';
+
+    map_range(view, y, &from, &to);
+    if (from < blob_length(view->blob)) {
+        minimap_get(view->blob, from, to, &s);
+        if (!s.bytes) {
+            c = '?';
         }
         else {
-            next_color = in_selection ? color_yellow
-                       : isalnum(b) ? color_cyan
-                       : isprint(b) ? color_blue
-                       : !b ? color_red
-                       : color_normal;
-            BOTH(
-                if (view->color && next_color != last_color)
-                    fputs(next_color, fp);
-            );
-            fputc(isprint(b) ? b : '.', asciifp);
-            fputs(digits, hexfp);
+            double entropy = s.entropy / s.bytes;
+            c = shades[min(9, entropy * 10 / 8)];
+            attr = s.zeros >= .9 * s.bytes ? COLOR_RED
+                 : s.printable >= .75 * s.bytes ? COLOR_CYAN
+                 : entropy >= 7.5 ? COLOR_PURPLE
+                 : COLOR_NORMAL;
+            if (!view->color)
+                attr = 0;
         }
-        last_color = next_color;
+        if (max(from, view->start) < min(max(to, from + 1), view_end(view)))
+            attr |= ATTR_BOLD;
+        if (from <= view->input->cur && (view->input->cur < to || view->input->cur == from))
+            attr |= ATTR_INVERSE;
+    }
 
-        if (view->color)
-            fputc(' ', hexfp);
-        else {
-            if (I->mode == SELECT && off + j + 1 == sel_start)
-                fputc('<', hexfp);
-            else if (I->mode == SELECT && off + j == sel_end)
-                fputc('>', hexfp);
-            else if (in_selection)
-                fputc('_', hexfp);
-            else
-                fputc(' ', hexfp);
+    cells[0] = blank_cell;
+    for (unsigned j = 1; j < MAP_WIDTH; ++j)
+        cells[j] = (struct cell) {c, attr};
+}
+
+void view_map(struct view *view, bool on)
+{
+    if (on && !view->map && !minimap_start(view->blob)) {
+        view_error(view, "the map is shown for the other file.");
+        return;
+    }
+    if (!on && view->map)
+        minimap_release();
+    view->map = on;
+    /* clicks on the map of other panes still count */
+    term_mouse(minimap_shown());
+    view_dirty_from(view, 0);
+    view_recompute(view, true);
+}
+
+/* halves or doubles the part of the blob shown, around the cursor */
+void view_map_zoom(struct view *view, bool in)
+{
+    size_t len = blob_length(view->blob);
+    size_t span = view->map_len ? view->map_len : len;
+
+    span = in ? max(span / 2, view->rows) : 2 * span;
+    if (span >= len) {
+        view->map_start = view->map_len = 0;
+        return;
+    }
+    view->map_len = span;
+    view->map_start = min(view->input->cur - min(view->input->cur, span / 2), len - span);
+}
+
+/* position for a click at terminal coordinates x, y (starting at 0) */
+bool view_map_pos(struct view const *view, unsigned x, unsigned y, size_t *pos)
+{
+    size_t from, to;
+
+    if (!map_width(view) || x < view->left + text_width(view) || x >= view->left + view->width
+            || y < view->top || y >= view->top + view->rows)
+        return false;
+
+    map_range(view, y - view->top, &from, &to);
+    if (from >= blob_length(view->blob))
+        return false;
+    *pos = from;
+    return true;
+}
+
+/* rows beyond this are empty */
+static size_t view_last(struct view const *view)
+{
+    size_t last = view->input->cur + 1;
+    for (struct view const *v = view; v; v = v == view ? view->peer : NULL) {
+        size_t len = blob_length(v->blob);
+        if (v->shift < 0 || len > (size_t) v->shift)
+            last = max(last, len - v->shift);
+    }
+    return last;
+}
+
+/* diff mode: the other side shows the same rows */
+static void follow(struct view *view, struct view const *leader)
+{
+    bool moved = view->start != leader->start || view->rows != leader->rows
+              || view->cols != leader->cols || view->pos_digits != leader->pos_digits;
+
+    if (view->rows != leader->rows)
+        view->dirty = realloc_strict(view->dirty, leader->rows * sizeof(*view->dirty));
+
+    view->start = leader->start;
+    view->rows = leader->rows;
+    view->cols = leader->cols;
+    view->pos_digits = leader->pos_digits;
+    view->color = leader->color;
+
+    for (unsigned l = 0; l < view->rows; ++l)
+        view->dirty[l] = moved ? 1 : max(view->dirty[l], leader->dirty[l]);
+}
+
+static void draw(struct view *view)
+{
+    struct cell line[max(view->width, 1)];
+    size_t last = view_last(view);
+
+    /* messages cover the bottom rows until the next keypress */
+    unsigned msg_rows = 0;
+    if (view->message) {
+        msg_rows = 1;
+        for (char const *p = view->message; *p; ++p)
+            msg_rows += *p == '\n';
+        msg_rows = min(msg_rows, view->rows);
+    }
+
+    for (size_t i = view->start, l = 0; i < view_end(view); i += view->cols, ++l) {
+        /* also rows something else was printed over */
+        if ((!view->dirty[l] && screen_known(view->top + l, view->left)) || l >= view->rows - msg_rows)
+            continue;
+        view->dirty[l] = 0;
+        uint64_t trl = trace_begin();
+        unsigned n = i >= last ? 0
+                   : cacheable(view, i) ? render_cached(view, i, last, line)
+                   : render_line(view, i, last, line);
+        trace_end("render_line", trl);
+        for (unsigned j = n; j < text_width(view); ++j)
+            line[j] = blank_cell;
+        screen_commit(view->top + l, view->left, line, text_width(view));
+    }
+
+    if (map_width(view))
+        for (unsigned l = 0; l < view->rows - msg_rows; ++l) {
+            render_map(view, l, line);
+            screen_commit(view->top + l, view->left + text_width(view), line, MAP_WIDTH);
         }
+
+    if (view->message) {
+        char const *p = view->message;
+        for (unsigned l = view->rows - msg_rows; l < view->rows; ++l) {
+            size_t n = strcspn(p, "\n");
+            for (unsigned j = 0; j < view->width; ++j) {
+                line[j] = blank_cell;
+                if (j >= view->pos_digits + 2 && j - view->pos_digits - 2 < n)
+                    line[j].glyph = p[j - view->pos_digits - 2], line[j].attr = view->color ? view->message_color : 0;
+            }
+            screen_commit(view->top + l, view->left, line, view->width);
+            view->dirty[l] = 1; /* redraw at the next keypress */
+            p += n + !!p[n];
+        }
+        free(view->message);
+        view->message = NULL;
     }
-    if (view->color) fputs(color_normal, hexfp);
-
-#undef BOTH
-    if (fclose(hexfp))
-        pdie("fclose");
-    if (fclose(asciifp))
-        pdie("fclose");
-    printf("%s|%s%s|", hexptr, asciiptr, view->color ? color_normal : "");
-    free(hexptr);
-    free(asciiptr);
-
-    fflush(stdout);  /* done immediately to prevent flushing partial lines later */
 }
 
+/* draws what changed; screen_flush() sends it to the terminal */
 void view_update(struct view *view)
 {
+    uint64_t tr = trace_begin();
+
     if (view->input->mode == COMMAND || view->input->mode == SEARCH)
         /* cursor may still be visible by accident after a signal */
-        fputs(hide_cursor, stdout);
-
-    size_t last = max(blob_length(view->blob), view->input->cur + 1);
+        screen_puts(hide_cursor);
 
     if (view->scroll) {
-        if (!term.is_basic)
-            scroll(view->scroll);
+        /* scrolling moves the whole terminal */
+        if (!term.is_basic && view->width == screen.width && view->rows == screen.height)
+            screen_scroll(view->scroll);
         else
             view_dirty_from(view, 0);
         view->scroll = 0;
     }
 
-    for (size_t i = view->start, l = 0; i < view_end(view); i += view->cols, ++l) {
-        /* dirtiness counter enables displaying messages until keypressed; */
-        if (!view->dirty[l] || --view->dirty[l])
-            continue;
-        cursor_line(l);
-        print(clear_line);
-        if (i < last)
-            render_line(view, i, last);
+    if (view->peer) {
+        follow(view->peer, view);
+        draw(view->peer);
     }
+    draw(view);
 
-    fflush(stdout);
+    trace_end("view_update", tr);
 }
 
 void view_dirty_at(struct view *view, size_t pos)
@@ -8,7 +8,9 @@
 #include <stdint.h>
 #include <stddef.h>
 #include <assert.h>
-#include <setjmp.h>
+
+#include "ansi.h"
+#include "blob.h"
 
 struct input;
 
@@ -21,24 +23,47 @@ struct view {
     uint8_t *dirty;
     signed scroll;
 
+    unsigned left, top;     /* first terminal column and row */
     unsigned width, height; /* terminal dimensions */
+    bool inactive;          /* another pane has the keyboard */
 
     bool cols_fixed;
     unsigned rows, cols; /* bytes currently in view */
     unsigned pos_digits;
     bool color;
+
+    char *message;
+    enum color message_color;
+
+    /* sidebar summarizing [map_start, map_start + map_len), or everything */
+    bool map;
+    size_t map_start, map_len;
+
+    /* diff mode: the other side, kept in sync by the view with the input;
+     * row position pos shows blob position pos + shift */
+    struct view *peer;
+    ssize_t shift;
+
+    /* redraws what other panes or undo change */
+    struct blob_observer observer;
 };
 
 void view_init(struct view *view, struct blob *blob, struct input *input);
+void view_layout(struct view *view, unsigned left, unsigned top, unsigned width, unsigned height);
 void view_recompute(struct view *view, bool changed);
 void view_set_cols(struct view *view, bool relative, int cols);
 void view_free(struct view *view);
+void view_cache_free(void);
 
-void view_message(struct view *view, char const *msg, char const *color);
+void view_message(struct view *view, char const *msg, enum color color);
 void view_error(struct view *view, char const *msg);
 
 void view_update(struct view *view);
 
+void view_map(struct view *view, bool on);
+void view_map_zoom(struct view *view, bool in);
+bool view_map_pos(struct view const *view, unsigned x, unsigned y, size_t *pos);
+
 void view_dirty_at(struct view *view, size_t pos);
 void view_dirty_from(struct view *view, size_t from);
 void view_dirty_fromto(struct view *view, size_t from, size_t to);